@@ -369,6 +369,33 @@ void MD5Checksum::Init()
 	m_lMD5[3] = MD5_INIT_STATE_3;
 }	
 	
+/*****************************************************************************************
+FUNCTION:		MD5Checksum::GetState, SetState
+DESCRIPTION:	Copy out or restore the state of a checksum in progress, so that it
+                may be continued by another object, in another process
+ARGUMENTS:		state : the state
+*****************************************************************************************/
+void MD5Checksum::GetState(MD5State *state)
+{
+	memcpy( state->buffer, m_lpszBuffer, 64 );
+	state->count[0] = m_nCount[0];
+	state->count[1] = m_nCount[1];
+	memcpy( state->md5, m_lMD5, sizeof(m_lMD5) );
+	state->byteCount = mByteCount;
+	state->didFinal = mDidFinal;
+}
+
+void MD5Checksum::SetState(const MD5State *state)
+{
+	memcpy( m_lpszBuffer, state->buffer, 64 );
+	m_nCount[0] = state->count[0];
+	m_nCount[1] = state->count[1];
+	memcpy( m_lMD5, state->md5, sizeof(m_lMD5) );
+	m_MD5str[0] = '\0';
+	mByteCount = state->byteCount;
+	mDidFinal = state->didFinal;
+}
+
 /*****************************************************************************************
 FUNCTION:		MD5Checksum::DWordToByte
 DETAILS:		private
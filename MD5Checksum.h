@@ -309,6 +309,16 @@ typedef u_int32         DWORD;
 typedef u_int16         UINT;
 typedef u_int32         ULONG;
 
+// the state of a checksum in progress
+struct MD5State
+{
+	BYTE  buffer[64];
+	ULONG count[2];
+	ULONG md5[4];
+	long  byteCount;
+	int   didFinal;
+};
+
 class MD5Checksum  
 {
 public:
@@ -319,6 +329,8 @@ public:
 	void    Update(BYTE* Input, ULONG nInputLen);
 	char  * GetMD5();
 	long    GetByteCount()      { return mByteCount;    }
+	void    GetState(MD5State *state);
+	void    SetState(const MD5State *state);
 	
 	static char *   GetMD5(char *filename);
 
@@ -15,6 +15,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "PZdabWriter.h"
 #include "CUtils.h"
 #include "Record_Info.h"
@@ -81,7 +82,8 @@ static void rewrite_zdab(char *infile, char *outfile)
 **********************************************************************************/
 
 //*** open zdab file and reset counters ***//
-PZdabWriter::PZdabWriter(char *file_name, int calcMD5)
+PZdabWriter::PZdabWriter(char *file_name, int calcMD5,
+                         const SZdabWriterState *resume)
 {
     mBytesWritten = 0;
     mWritePos = 0;
@@ -106,6 +108,12 @@ PZdabWriter::PZdabWriter(char *file_name, int calcMD5)
     strncpy((char *)zdab_output_file,file_name,MAX_NAMELEN);
     zdab_output_file[MAX_NAMELEN-1] = '\0';
     
+    InitRecords();
+    if (resume) {
+        Resume(resume);
+        return;
+    }
+
     //FZ physical records counter
     irec = (u_int32)(-1);
 
@@ -205,34 +213,14 @@ PZdabWriter::PZdabWriter(char *file_name, int calcMD5)
     mpr[6] = NPHREC;
     mpr[7] = 0;
 
-    // logical record type
-    mlr[1] = 2;
-
-    // pilot record information (signature and ZEBRA version)
-    mpili[0] = 0x4640e400UL;
-    mpili[1] = 37700;
-    mpili[2] = 0;
-    mpili[3] = 0;
-    mpili[4] = 0;
-    mpili[5] = 0;
-    mpili[6] = 0;   // this is 2 for MAST banks
-    mpili[7] = 0;
-    mpili[8] = 0;   // this is 'SUPP_BANK_LINK' for MAST banks
-    mpili[9] = 0;
-    mpili[10]= BASE_LINK;   // 1st link of MAST relocation table (constant)
-
-    // bank information (name, etc.) 
-    // (all but mbk[0] must be set for the specific bank type)
-    mbk[0] = 0; // constant
-    mbk[1] = 0;
-    mbk[2] = 0;
-    mbk[3] = 0;
-    mbk[4] = 0;
-    mbk[5] = 0;
-    mbk[6] = 0;
-    mbk[7] = 0;
-    mbk[8] = 0;
+    // add first steering block to the buffer
+    ipos = 0;
+    ADD_RECORD(mpr);
+}
 
+// fill in the fixed records written when the file is closed
+void PZdabWriter::InitRecords()
+{
     // end of run record
     meor[0] = 1;   // record length
     meor[1] = 1;   // record type
@@ -245,14 +233,63 @@ PZdabWriter::PZdabWriter(char *file_name, int calcMD5)
     meoz[3] =  0;
     meoz[4] =  0;
     meoz[5] = 73;
-    
-    // mast bank data
-    mMastData.currentVersion = SNOMAN_VERSION;
-    mMastData.originalVersion = ORIGINAL_VERSION;
-    
-    // add first steering block to the buffer
-    ipos = 0;
-    ADD_RECORD(mpr);
+}
+
+// reopen the file and cut it back to the bytes written when the state was
+// saved, then carry on from that state
+void PZdabWriter::Resume(const SZdabWriterState *state)
+{
+    zdaboutput = fopen(zdab_output_file,"r+b");
+    if (!zdaboutput) {
+        printf("Error reopening output zdab file %s\x07\n",zdab_output_file);
+        mError = 1;
+        return;
+    }
+    fseek(zdaboutput, 0, SEEK_END);
+    if (ftell(zdaboutput) < (long)state->bytesWritten ||
+        ftruncate(fileno(zdaboutput), state->bytesWritten) ||
+        fseek(zdaboutput, state->bytesWritten, SEEK_SET))
+    {
+        printf("Error: Output zdab file %s is shorter than the saved state\x07\n",
+               zdab_output_file);
+        fclose(zdaboutput);
+        zdaboutput = NULL;
+        mError = 1;
+        return;
+    }
+    mBytesWritten = state->bytesWritten;
+    memcpy(mbuf, state->buf, sizeof(mbuf));
+    memcpy(mpr, state->pr, sizeof(mpr));
+    irec = state->irec;
+    ipos = state->ipos;
+    mWritePos = state->writePos;
+    mCalcMD5 = state->calcMD5;
+    if (mCalcMD5) {
+        mMD5.SetState(&state->md5);
+    }
+    printf("Resuming output zdab file %s at byte %lu\n",zdab_output_file,
+           (unsigned long)mBytesWritten);
+}
+
+// save the state of the writer, once everything written so far has reached
+// the file, so that writing may be resumed from it
+// returns zero on success
+int PZdabWriter::GetState(SZdabWriterState *state)
+{
+    if (!zdaboutput || fflush(zdaboutput)) return(1);
+    state->bytesWritten = mBytesWritten;
+    memcpy(state->buf, mbuf, sizeof(mbuf));
+    memcpy(state->pr, mpr, sizeof(mpr));
+    state->irec = irec;
+    state->ipos = ipos;
+    state->writePos = mWritePos;
+    state->calcMD5 = mCalcMD5;
+    if (mCalcMD5) {
+        mMD5.GetState(&state->md5);
+    } else {
+        memset(&state->md5, 0, sizeof(state->md5));
+    }
+    return(mError);
 }
 
 //*** ZEBRA end of run/file signature (has to be on a steering block) ***//
@@ -319,11 +356,11 @@ int PZdabWriter::GetBankNWords(int index)
 }
 
 // WriteBank - write an arbitrary bank to the file
+// - bank is in native format, and is swapped back after writing
 // - returns 0 on success
 int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
 {
-    int i, nsize, hdr_size, nfast, nio_nl;
-    int npilot, mast_nio_nl = 0, fast = 0;
+    int nsize, err;
     
     if (!zdaboutput) {
         printf("Zdab output file not open!\n");
@@ -334,16 +371,80 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
     // they will be written automatically before the appropriate banks
     if (index == kMASTindex) return(0);
     
-    // must set the size of PMT event records (since it is variable)
+    // get the size of the record to be written
+    // (the size of PMT event records is variable)
+    // and byte swap the bank to the external format
     if (index == kZDABindex) {
-        sBankDef[kZDABindex].nwords = PZdabFile::GetSize((PmtEventRecord *)bank_ptr) / sizeof(u_int32);
+        nsize = PZdabFile::GetSize((PmtEventRecord *)bank_ptr) / sizeof(u_int32);
         // K Labe - Feb 3 2015
         // Adding this line for consistency with newer version of PZdabWriter
         SWAP_INT32(bank_ptr, 11);
+    } else {
+        nsize = sBankDef[index].nwords;
+        SWAP_INT32(bank_ptr, nsize);
     }
-    
-    // get the size of the record to be written
-    nsize = sBankDef[index].nwords;
+
+    err = WriteData(bank_ptr, index, nsize);
+
+    // byte swap the bank back again
+    SWAP_INT32(bank_ptr, nsize);
+
+    // KLabe - February 3 2015 - SWAP back if necessary
+    if(index == kZDABindex)
+      SWAP_INT32(bank_ptr, 11);
+
+    return(err);
+}
+
+// WriteExternal - write a bank already in external format to the file
+// - the bank is not modified, so it may be shared
+// - nwords gives the size of ZDAB banks; other banks have a fixed size
+// - returns 0 on success
+int PZdabWriter::WriteExternal(const u_int32 *bank_ptr, int index, int nwords)
+{
+    if (!zdaboutput) {
+        printf("Zdab output file not open!\n");
+        return(-1);
+    }
+    if (index == kMASTindex) return(0);
+    return(WriteData(bank_ptr, index,
+                     index == kZDABindex ? nwords : sBankDef[index].nwords));
+}
+
+// EncodeBank - encode a bank in external format as a ZEBRA logical record
+// - out must have room for nwords + NHEADMAX words
+// - nwords gives the size of ZDAB banks; other banks have a fixed size
+// - the number of words before the bank data is returned in nhead
+// - returns the number of words in the record
+int PZdabWriter::EncodeBank(const u_int32 *bank_ptr, int index, int nwords,
+                            u_int32 *out, int *nhead)
+{
+    int nsize = (index == kZDABindex) ? nwords : sBankDef[index].nwords;
+    *nhead = EncodeHeader(index, nsize, out);
+    memcpy(out + *nhead, bank_ptr, nsize * sizeof(u_int32));
+    return(*nhead + nsize);
+}
+
+// EncodeHeader - encode the logical record, pilot and bank headers which
+// go before nsize words of bank data
+// - the header is left in external format
+// - returns the number of words in the header
+int PZdabWriter::EncodeHeader(int index, int nsize, u_int32 *head)
+{
+    int n, hdr_size, nio_nl, npilot, mast_nio_nl = 0;
+    u_int32 *bk;
+
+    // pilot record information (signature and ZEBRA version)
+    u_int32 pili[NPILOT+2] = {
+        0x4640e400UL, 37700, 0, 0, 0, 0,
+        0,              // this is 2 for MAST banks
+        0,
+        0,              // this is 'SUPP_BANK_LINK' for MAST banks
+        0,
+        BASE_LINK,      // 1st link of MAST relocation table (constant)
+        0
+    };
+
     // get the number of i/o control words and links
     nio_nl = (int)(sBankDef[index].iochar[0] & 0x0000ffff) - 12;
 
@@ -354,18 +455,123 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
         // add size of MAST bank (goes before all but ZDAB banks)
         mast_nio_nl = (int)(sBankDef[kMASTindex].iochar[0] & 0x0000ffff) - 12;
         hdr_size += 1 + mast_nio_nl + NBANK + sBankDef[kMASTindex].nwords;
-        mpili[6] = 2;                               // 2 entries in relocation table
-        mpili[8] = SUPP_BANK_LINK;                  // entry link
-        mpili[11] = BASE_LINK + hdr_size + nsize;   // 2nd relocation table entry
-    } else {
-        mpili[6] = 0;           // no relocation table
-        mpili[8] = 0;           // no entry link
+        pili[6] = 2;                                // 2 entries in relocation table
+        pili[8] = SUPP_BANK_LINK;                   // entry link
+        pili[11] = BASE_LINK + hdr_size + nsize;    // 2nd relocation table entry
     }
-    npilot = NPILOT + mpili[6]; // write relocation table with pilot record
+    npilot = NPILOT + pili[6];  // write relocation table with pilot record
+
+    // logical record info (size and data type)
+    head[0] = npilot + hdr_size + nsize;
+    head[1] = 2;
+    n = NLOGIC;
+
+    // Pilot record info (mostly constant except for bank material size)
+    pili[7] = hdr_size + nsize;
+    memcpy(head + n, pili, npilot * sizeof(u_int32));
+    n += npilot;
+
+    // add MAST bank if necessary
+    if (index != kZDABindex) {
+        // copy the MAST i/o characteristic and first clear all the mast links
+        u_int32 *mast_iochar = head + n;
+        memcpy(mast_iochar, sBankDef[kMASTindex].iochar, (mast_nio_nl + 1) * sizeof(u_int32));
+        int nlinks = sBankDef[kMASTindex].nlinks;
+        memset(mast_iochar + 1 + (mast_nio_nl - nlinks), 0, nlinks * sizeof(u_int32));
+        // then set the link for the bank we are writing
+        mast_iochar[1 + mast_nio_nl - sBankDef[index].id] 
+            = BASE_LINK + 1 + mast_nio_nl + NBANK + sBankDef[kMASTindex].nwords + 1 + nio_nl;
+        n += mast_nio_nl + 1;
+        
+        // add MAST Bank info
+        bk = head + n;
+        bk[0] = 0;
+        bk[1] = 0;
+        bk[2] = 0;
+        bk[3] = sBankDef[kMASTindex].id;
+        bk[4] = sBankDef[kMASTindex].name;
+        bk[5] = sBankDef[kMASTindex].nlinks;
+        bk[6] = sBankDef[kMASTindex].nlinks;
+        bk[7] = sBankDef[kMASTindex].nwords;
+        bk[8] = sBankDef[kMASTindex].status;
+        n += NBANK;
+        
+        // add the MAST bank data
+        MastRecord mast;
+        mast.currentVersion = SNOMAN_VERSION;
+        mast.originalVersion = ORIGINAL_VERSION;
+        memcpy(head + n, &mast, sizeof(mast));
+        n += WORD_SIZE(mast);
+    }
+    
+    // add the i/o characteristic for the bank we are writing
+    memcpy(head + n, sBankDef[index].iochar, (nio_nl + 1) * sizeof(u_int32));
+    n += nio_nl + 1;
+    
+    // add Bank info
+    bk = head + n;
+    bk[0] = 0;
+    bk[1] = SUPP_BANK_LINK;
+    bk[2] = SUPP_BANK_LINK - sBankDef[index].id;
+    bk[3] = sBankDef[index].id;
+    bk[4] = sBankDef[index].name;
+    bk[5] = sBankDef[index].nlinks;
+    bk[6] = sBankDef[index].nlinks;
+    bk[7] = nsize;
+    bk[8] = sBankDef[index].status;
+    n += NBANK;
+
+    SWAP_INT32(head, n);
+    return(n);
+}
+
+// WriteEncoded - write logical records encoded by EncodeBank to the file
+// - the records are copied whole into the current physical record
+// - returns 1 without writing anything if they do not fit in it
+int PZdabWriter::WriteEncoded(const u_int32 *words, int nwords)
+{
+    if (!zdaboutput) {
+        printf("Zdab output file not open!\n");
+        return(-1);
+    }
+    // (leave room so that no record ends exactly at the end of the block)
+    if (ipos + nwords >= NWREC) return(1);
+    memcpy(mbuf + ipos, words, nwords * sizeof(u_int32));
+    ipos += nwords;
+    return(0);
+}
+
+// WriteEncoded - write one logical record encoded by EncodeBank to the file
+// - returns 0 on success
+int PZdabWriter::WriteEncoded(const u_int32 *words, int nhead, int nwords)
+{
+    if (!zdaboutput) {
+        printf("Zdab output file not open!\n");
+        return(-1);
+    }
+    return(WriteLogical(words, nhead, words + nhead, nwords - nhead));
+}
+
+// WriteData - write nsize words of bank data in external format
+// - returns 0 on success
+int PZdabWriter::WriteData(const u_int32 *bank_ptr, int index, int nsize)
+{
+    u_int32 head[NHEADMAX];
+    int nhead = EncodeHeader(index, nsize, head);
+    return(WriteLogical(head, nhead, bank_ptr, nsize));
+}
+
+// WriteLogical - write a logical record, given its encoded header of nhead
+// words and nsize words of bank data, both in external format
+// - returns 0 on success
+int PZdabWriter::WriteLogical(const u_int32 *head, int nhead,
+                              const u_int32 *bank_ptr, int nsize)
+{
+    int i, nfast, fast = 0;
 
     // start a logical record if we have already written the steering block and the
     // next record will need a fast block
-    if (mWritePos && ipos + NLOGIC + npilot + hdr_size + nsize > 2 * NWREC - NPHREC) {
+    if (mWritePos && ipos + nhead + nsize > 2 * NWREC - NPHREC) {
         if (WritePhysicalRecord()) {
             fclose(zdaboutput);
             zdaboutput = NULL;
@@ -381,7 +587,7 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
 
     //do not start a logical record if not enough room
     //(otherwise complete the steering block with a padding block)
-    if ( ipos >= (u_int32)(NWREC-NLOGIC-npilot-hdr_size) ) {
+    if ( ipos >= (u_int32)(NWREC-nhead) ) {
         if (WritePhysicalRecord()) {
             fclose(zdaboutput);
             zdaboutput = NULL;
@@ -395,59 +601,10 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
         ADD_RECORD(mpr);
     }
 
-    // logical record info (size and data type)
-    mlr[0] = npilot + hdr_size + nsize;
-    ADD_RECORD(mlr);
-
-    // Pilot record info (mostly constant except for bank material size)
-    mpili[7] = hdr_size + nsize;
-    AddRecord(mpili, npilot);
-
-    // add MAST bank if necessary
-    if (index != kZDABindex) {
-        // first clear all the mast links
-        int nlinks = sBankDef[kMASTindex].nlinks;
-        memset(sBankDef[kMASTindex].iochar + 1 + (mast_nio_nl - nlinks), 0, nlinks * sizeof(u_int32));
-        // then set the link for the bank we are writing
-        sBankDef[kMASTindex].iochar[1 + mast_nio_nl - sBankDef[index].id] 
-            = BASE_LINK + 1 + mast_nio_nl + NBANK + sBankDef[kMASTindex].nwords + 1 + nio_nl;
-        // add the i/o characteristic for the MAST bank
-        AddRecord(sBankDef[kMASTindex].iochar, mast_nio_nl + 1);
-        
-        // add MAST Bank info
-        mbk[1] = 0;
-        mbk[2] = 0;
-        mbk[3] = sBankDef[kMASTindex].id;
-        mbk[4] = sBankDef[kMASTindex].name;
-        mbk[5] = sBankDef[kMASTindex].nlinks;
-        mbk[6] = sBankDef[kMASTindex].nlinks;
-        mbk[7] = sBankDef[kMASTindex].nwords;
-        mbk[8] = sBankDef[kMASTindex].status;
-        ADD_RECORD(mbk);
-        
-        // add the MAST bank data
-        ADD_RECORD(mMastData);
-    }
+    // add the logical record, pilot and bank headers
+    memcpy(mbuf + ipos, head, nhead * sizeof(u_int32));
+    ipos += nhead;
     
-    // add the i/o characteristic for the bank we are writing
-    AddRecord(sBankDef[index].iochar, nio_nl + 1);
-    
-    // add Bank info
-    mbk[1] = SUPP_BANK_LINK;
-    mbk[2] = SUPP_BANK_LINK - sBankDef[index].id;
-    mbk[3] = sBankDef[index].id;
-    mbk[4] = sBankDef[index].name;
-    mbk[5] = sBankDef[index].nlinks;
-    mbk[6] = sBankDef[index].nlinks;
-    mbk[7] = nsize;
-    mbk[8] = sBankDef[index].status;
-    ADD_RECORD(mbk);
-    
-    // byte swap the bank to the external format
-    if(index!=kZDABindex){
-        SWAP_INT32(bank_ptr, nsize);
-    }    
-
     // write the bank data
     for (i=0; i<nsize; ++i) { 
         if (ipos > NWREC-1) {
@@ -502,9 +659,6 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
         ++ipos;
     }
     
-    // byte swap the bank back again
-    SWAP_INT32(bank_ptr, nsize);
-    
     if (mError) {
         printf("Error writing to output zdab file %s!  File closed.\x07\n",zdab_output_file);
         return(-1);
@@ -527,10 +681,6 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
         fast = 0;
     }
 
-    // KLabe - February 3 2015 - SWAP back if necessary
-    if(index == kZDABindex)
-      SWAP_INT32(bank_ptr, 11);
-
     return(0);
 }
 
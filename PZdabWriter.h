@@ -17,6 +17,7 @@
 #define NBANK       9       // Bank record
 #define NEOR        3       // End of run record
 #define NEOZ        6       // End of zebra record
+#define NHEADMAX    128     // Maximum encoded header before the bank data
 
 #define MAX_NAMELEN 256
 
@@ -44,10 +45,23 @@ struct SBankDef {
 };
 
 
+// state of a writer, from which writing may be resumed by another
+// process once the file is cut back to the bytes written
+struct SZdabWriterState {
+    u_int32     bytesWritten;
+    u_int32     buf[NWREC];
+    u_int32     pr[NPHREC];
+    u_int32     irec, ipos;
+    u_int32     writePos;
+    int         calcMD5;
+    MD5State    md5;
+};
+
 // class definition
 class PZdabWriter {
 public:
-    PZdabWriter(char *file_name, int calcMD5=0);
+    PZdabWriter(char *file_name, int calcMD5=0,
+                const SZdabWriterState *resume=NULL);
     ~PZdabWriter();
 
     int         IsOpen()        { return zdaboutput != NULL; }
@@ -55,6 +69,9 @@ public:
     int         Close();
     
     int         WriteBank(u_int32 *bank_ptr, int index);
+    int         WriteExternal(const u_int32 *bank_ptr, int index, int nwords);
+    int         WriteEncoded(const u_int32 *words, int nwords);
+    int         WriteEncoded(const u_int32 *words, int nhead, int nwords);
 
     int         Write(PmtEventRecord *aPmtRecord) {
                     return WriteBank((u_int32 *)aPmtRecord, kZDABindex);
@@ -64,11 +81,20 @@ public:
     u_int32     GetBytesWritten()   { return mBytesWritten; }
     char      * GetFilename()       { return zdab_output_file; }
     int         Flush();
+    int         GetState(SZdabWriterState *state);
     
     static int  GetIndex(u_int32 bank_name);
     static int  GetBankNWords(int index);
+    static int  EncodeBank(const u_int32 *bank_ptr, int index, int nwords,
+                           u_int32 *out, int *nhead);
 
 private:
+    void        InitRecords();
+    void        Resume(const SZdabWriterState *state);
+    int         WriteData(const u_int32 *bank_ptr, int index, int nsize);
+    int         WriteLogical(const u_int32 *head, int nhead,
+                             const u_int32 *bank_ptr, int nsize);
+    static int  EncodeHeader(int index, int nsize, u_int32 *head);
     void        AddRecord(u_int32 *data, u_int32 nwords);
     int         WritePhysicalRecord();
     int         FWrite(void *buff, unsigned long size);
@@ -76,9 +102,6 @@ private:
     u_int32     mBytesWritten;
     u_int32     mbuf[NWREC];
     u_int32     mpr[NPHREC];
-    u_int32     mlr[NLOGIC]; 
-    u_int32     mpili[NPILOT+2];    // 2 extra words for MAST relocation table entries
-    u_int32     mbk[NBANK];
     u_int32     meor[NEOR];
     u_int32     meoz[NEOZ];
     u_int32     irec, ipos;
@@ -87,8 +110,6 @@ private:
     int         mCalcMD5;
     MD5Checksum mMD5;
     u_int32     mWritePos;          // current write position
-    
-    MastRecord  mMastData;
 
     char        zdab_output_file[MAX_NAMELEN];
     FILE     *  zdaboutput;
@@ -0,0 +1,119 @@
+// Burstcat
+// K Labe, October 18 2026
+
+// Burstcat lists the bursts recorded in the burst catalog written by
+// stonehenge (see sncat.h), without opening any ZDAB files.  Bursts may be
+// selected by run, and within a run by start time; both are found by binary
+// search, since the catalog is in order of run and start time.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "struct.h"
+#include "sncat.h"
+
+// This function prints the help text
+static void printhelp(){
+  printf(
+  "Burstcat: List bursts from the stonehenge burst catalog.\n"
+  "\n"
+  "Options:\n"
+  "  -f [string]: Catalog file (default " SNCATALOG ")\n"
+  "  -r [int]: Only bursts of this run\n"
+  "  -s [float]: With -r, only bursts starting at or after this time (s)\n"
+  "  -e [float]: With -r, only bursts starting before this time (s)\n"
+  "  -h: This help text\n"
+  );
+}
+
+// This function orders records by run, and then by start time
+static bool Before(const sncatrec & a, const sncatrec & b){
+  if(a.run != b.run)
+    return a.run < b.run;
+  return a.starttick < b.starttick;
+}
+
+// This function prints one record
+static void PrintRecord(const sncatrec & rec){
+  printf("run %u subfile %d burst %d%s%s\n", rec.run, rec.subfile, rec.burst,
+         (rec.flags & kCatContinued) ? " (continued)" : "",
+         (rec.flags & kCatContinues) ? " (continues)" : "");
+  printf("  start %.6f s  end %.6f s  lasted %.2f s\n",
+         rec.starttick/50000000., rec.endtick/50000000.,
+         (rec.endtick - rec.starttick)/50000000.);
+  printf("  %u events, GTID %u to %u\n", rec.nevents, rec.firstgtid,
+         rec.lastgtid);
+  printf("  peak rate %.1f Hz", rec.peakrate[0]);
+  for(int i=1; i<MAXWINDOWS+1; i++){
+    if(rec.peakrate[i] > 0)
+      printf(", window %d %.1f Hz", i, rec.peakrate[i]);
+  }
+  printf("\n  %s  first event after byte %lu of %lu\n", rec.path,
+         (unsigned long) rec.firstoffset, (unsigned long) rec.nbytes);
+}
+
+int main(int argc, char *argv[]){
+  const char* catalog = SNCATALOG;
+  bool byrun = false;
+  sncatrec lo, hi;
+  memset(&lo, 0, sizeof(lo));
+  memset(&hi, 0, sizeof(hi));
+  hi.starttick = UINT64_MAX;
+
+  int ch;
+  while((ch = getopt(argc, argv, "hf:r:s:e:")) != -1){
+    switch(ch){
+      case 'f': catalog = optarg; break;
+      case 'r': byrun = true; lo.run = hi.run = strtoul(optarg, NULL, 10);
+                break;
+      case 's': lo.starttick = atof(optarg)*50000000.; break;
+      case 'e': hi.starttick = atof(optarg)*50000000.; break;
+      case 'h': printhelp(); exit(0);
+      default:  printhelp(); exit(1);
+    }
+  }
+
+  int fd = open(catalog, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st)){
+    fprintf(stderr, "Could not open burst catalog %s\n", catalog);
+    exit(1);
+  }
+  if(st.st_size < (off_t) sizeof(sncathdr)){
+    close(fd);
+    printf("No bursts in catalog.\n");
+    return 0;
+  }
+  char* map = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED){
+    fprintf(stderr, "Could not map burst catalog %s\n", catalog);
+    exit(1);
+  }
+  const sncathdr* hdr = (const sncathdr*) map;
+  if(memcmp(hdr->magic, sncatmagic, sizeof(sncatmagic)) ||
+     hdr->version != sncatversion || hdr->recsize != sizeof(sncatrec)){
+    fprintf(stderr, "%s is not a burst catalog of this version\n", catalog);
+    exit(1);
+  }
+
+  // A record still being appended is ignored
+  const sncatrec* first = (const sncatrec*) (map + sizeof(sncathdr));
+  const sncatrec* last = first +
+                         (st.st_size - sizeof(sncathdr))/sizeof(sncatrec);
+  if(byrun){
+    first = std::lower_bound(first, last, lo, Before);
+    last = std::lower_bound(first, last, hi, Before);
+  }
+  for(const sncatrec* rec = first; rec < last; rec++)
+    PrintRecord(*rec);
+
+  munmap(map, st.st_size);
+  return 0;
+}
@@ -0,0 +1,188 @@
+// Checkpoint Code
+//
+// K Labe October 18 2026
+
+#include "PZdabFile.h"
+#include "PZdabWriter.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <deque>
+#include "redis.h"
+#include "curl.h"
+#include "snwrite.h"
+#include "sncat.h"
+#include "output.h"
+#include "ckptio.h"
+#include "cuts.h"
+#include "gtidtrack.h"
+#include "l2engine.h"
+#include "checkpoint.h"
+
+// Layout of the checkpoint file: the magic and version, the records decided
+// and length of the catalog, the state of the writer, the state of the
+// engine, then the magic again to show that it is complete.  Every field is
+// written on its own (see ckptio.h).  Bump the version if any list of
+// fields changes.
+static const char ckptmagic[4] = {'S', 'N', 'C', 'K'};
+static const uint32_t ckptversion = 3;
+
+// This function names the checkpoint file of outfilebase
+static void CheckpointName(const char* const outfilebase, char* const name,
+                           const size_t len, const bool tmp){
+  snprintf(name, len, "%s.ckpt%s", outfilebase, tmp ? ".tmp" : "");
+}
+
+// This function writes or reads the state of the output writer, with its
+// checksum
+static void WriterFields(ckptfile & c, SZdabWriterState & ws){
+  Field(c, ws.bytesWritten);
+  Bytes(c, ws.buf, sizeof(ws.buf));
+  Fields(c, ws.pr, NPHREC);
+  Field(c, ws.irec);
+  Field(c, ws.ipos);
+  Field(c, ws.writePos);
+  Field(c, ws.calcMD5);
+  Bytes(c, ws.md5.buffer, sizeof(ws.md5.buffer));
+  Fields(c, ws.md5.count, 2);
+  Fields(c, ws.md5.md5, 4);
+  Field(c, ws.md5.byteCount);
+  Field(c, ws.md5.didFinal);
+}
+
+// This function makes the directory holding the file name durable, so that
+// a file renamed into it survives a power cut
+static bool SyncDirectory(const char* const name){
+  char dir[256];
+  snprintf(dir, sizeof(dir), "%s", name);
+  char* const slash = strrchr(dir, '/');
+  if(slash == NULL)
+    snprintf(dir, sizeof(dir), ".");
+  else if(slash == dir)
+    slash[1] = '\0';
+  else
+    *slash = '\0';
+  const int fd = open(dir, O_RDONLY);
+  if(fd < 0)
+    return false;
+  const bool ok = !fsync(fd);
+  close(fd);
+  return ok;
+}
+
+// This function writes a checkpoint
+bool WriteCheckpoint(const char* const outfilebase, PZdabWriter* const w,
+                     L2Engine & engine){
+  // Bursts which have ended must be in the catalog before it is measured
+  SyncWriter();
+  uint32_t version = ckptversion;
+  uint64_t records = engine.GetCounts().recordn;
+  struct stat st;
+  uint64_t catalogsize = stat(SNCATALOG, &st) ? 0 : st.st_size;
+  SZdabWriterState* const ws = new SZdabWriterState;
+  bool ok = !w->GetState(ws);
+
+  char name[256], tmpname[256];
+  CheckpointName(outfilebase, name, sizeof(name), false);
+  CheckpointName(outfilebase, tmpname, sizeof(tmpname), true);
+  ckptfile c;
+  c.f = ok ? fopen(tmpname, "wb") : NULL;
+  c.reading = false;
+  c.ok = c.f != NULL;
+  char magic[4];
+  memcpy(magic, ckptmagic, sizeof(magic));
+  Bytes(c, magic, sizeof(magic));
+  Field(c, version);
+  Field(c, records);
+  Field(c, catalogsize);
+  WriterFields(c, *ws);
+  engine.CheckpointFields(c);
+  Bytes(c, magic, sizeof(magic));
+  delete ws;
+
+  // The checkpoint must be on disk before it replaces the last one
+  ok = c.ok && !fflush(c.f) && !fsync(fileno(c.f));
+  if(c.f && fclose(c.f))
+    ok = false;
+  if(!ok || rename(tmpname, name) || !SyncDirectory(name)){
+    unlink(tmpname);
+    fprintf(stderr, "Could not write checkpoint %s.\n", name);
+    alarm(30, "Stonehenge: could not write checkpoint.", 0);
+    return false;
+  }
+  return true;
+}
+
+// This function reads a checkpoint
+PZdabWriter* ReadCheckpoint(char* const infilename,
+                            const char* const outfilebase, L2Engine & engine,
+                            uint64_t & records){
+  char name[256];
+  CheckpointName(outfilebase, name, sizeof(name), false);
+  ckptfile c;
+  c.f = fopen(name, "rb");
+  c.reading = true;
+  c.ok = true;
+  if(!c.f){
+    fprintf(stderr, "No checkpoint %s; starting from the beginning.\n", name);
+    return NULL;
+  }
+
+  // Check the version, and that the file is complete, before changing
+  // anything
+  char magic[4], end[4];
+  uint32_t version = 0;
+  Bytes(c, magic, sizeof(magic));
+  Field(c, version);
+  const long start = ftell(c.f);
+  const bool known = c.ok && !memcmp(magic, ckptmagic, sizeof(magic)) &&
+                     version == ckptversion;
+  c.ok = known && !fseek(c.f, -(long) sizeof(end), SEEK_END);
+  Bytes(c, end, sizeof(end));
+  c.ok = c.ok && !memcmp(end, ckptmagic, sizeof(end)) &&
+         !fseek(c.f, start, SEEK_SET);
+
+  uint64_t catalogsize = 0;
+  SZdabWriterState* const ws = new SZdabWriterState;
+  Field(c, records);
+  Field(c, catalogsize);
+  WriterFields(c, *ws);
+  engine.CheckpointFields(c);
+  fclose(c.f);
+  if(!c.ok){
+    delete ws;
+    if(!known)
+      fprintf(stderr, "Checkpoint %s is not of version %u.  Aborting.\n",
+              name, ckptversion);
+    else
+      fprintf(stderr, "Checkpoint %s is unreadable.  Aborting.\n", name);
+    alarm(40, "Stonehenge: checkpoint unreadable.  Aborting.", 13);
+    exit(1);
+  }
+
+  // The catalog is shared with other processes, which may have added to it
+  // since, so only this subfile's records are removed.  Its run is that of
+  // the events decided, or before any, that in its name, if there is one.
+  const long run = engine.GetCounts().eventn ? (long) engine.GetRun() :
+                                               zdab_get_run(infilename);
+  if(CutCatalog(catalogsize, run, zdab_get_subrun(infilename))){
+    fprintf(stderr, "Could not cut back the burst catalog.\n");
+    alarm(30, "Stonehenge: could not cut back the burst catalog.", 0);
+  }
+  PZdabWriter* const w = Reopen(outfilebase, *ws);
+  delete ws;
+  fprintf(stderr, "Resuming from checkpoint %s after %lu records.\n", name,
+          (unsigned long) records);
+  return w;
+}
+
+// This function removes the checkpoint
+void RemoveCheckpoint(const char* const outfilebase){
+  char name[256];
+  CheckpointName(outfilebase, name, sizeof(name), false);
+  unlink(name);
+}
@@ -0,0 +1,35 @@
+// Checkpoint Header
+//
+// K Labe, October 18 2026
+
+// A checkpoint records, part way through a subfile, what is needed to carry
+// on from that point after a crash: the number of records decided, the
+// state of the writer of the output file with its checksum, the length of
+// the burst catalog, and the state of the primary engine, the burst buffer
+// and the extra windows.  It is written to [outfilebase].ckpt under a
+// temporary name, flushed to disk, then renamed into place, so that a crash
+// or power cut while it is written leaves the last one intact.  A
+// checkpoint is only taken between batches, once every record decided has
+// been written out, and while no burst file is open.  The history ring is
+// not kept, so a burst file opened soon after resuming has less pre-trigger
+// history.
+
+// This function writes a checkpoint of the subfile written through w to
+// outfilebase, with the state of the engine.  It returns whether it did.
+bool WriteCheckpoint(const char* const outfilebase, PZdabWriter* const w,
+                     L2Engine & engine);
+
+// This function reads the checkpoint of the subfile infilename, written to
+// outfilebase, into the engine, which should be set up as the primary, after
+// the burst buffer.  It cuts the output file back to the checkpoint, and
+// removes the records of the subfile added to the burst catalog since, but
+// not those added by other processes.  It returns the writer of the output
+// file, with records set to the number of records of the input already
+// decided.  It returns NULL if there is no checkpoint, and aborts if there
+// is one which cannot be read.
+PZdabWriter* ReadCheckpoint(char* const infilename,
+                            const char* const outfilebase, L2Engine & engine,
+                            uint64_t & records);
+
+// This function removes the checkpoint once the subfile is finished.
+void RemoveCheckpoint(const char* const outfilebase);
@@ -0,0 +1,49 @@
+// Checkpoint Field Header
+//
+// K Labe, October 18 2026
+
+// A checkpoint is written and read one field at a time, each integer as 64
+// bits, so that the file does not depend on the layout or padding of any
+// structure in memory.  The same list of fields serves both ways: Field()
+// writes a field when the file is being written, and sets it when it is
+// being read.  After the first failure nothing more is done, and ok stays
+// false.  Any change to a list of fields needs a new checkpoint version (see
+// checkpoint.cpp).
+
+#include <type_traits>
+
+struct ckptfile
+{
+FILE* f;
+bool reading;
+bool ok;
+};
+
+// This function writes or reads the integer x
+template<typename T> static inline void Field(ckptfile & c, T & x){
+  static_assert(std::is_integral<T>::value, "checkpoint fields are integers");
+  if(!c.ok)
+    return;
+  uint64_t v = (uint64_t) x;
+  if(c.reading){
+    c.ok = fread(&v, sizeof(v), 1, c.f) == 1;
+    if(c.ok)
+      x = (T) v;
+  }
+  else
+    c.ok = fwrite(&v, sizeof(v), 1, c.f) == 1;
+}
+
+// This function writes or reads the n integers of the array x
+template<typename T> static inline void Fields(ckptfile & c, T* const x,
+                                               const size_t n){
+  for(size_t i=0; i<n && c.ok; i++)
+    Field(c, x[i]);
+}
+
+// This function writes or reads n bytes of raw data, such as a record
+static inline void Bytes(ckptfile & c, void* const x, const size_t n){
+  if(!c.ok || !n)
+    return;
+  c.ok = c.reading ? fread(x, n, 1, c.f) == 1 : fwrite(x, n, 1, c.f) == 1;
+}
@@ -1,11 +1,22 @@
 // Configuration Reader code
 //
 // K Labe - September 25 2014
+// K Labe - October 18 2026  Read the optional extra burst windows
+// K Labe - October 18 2026  Read the optional prescale and its nhit tiers
+// K Labe - October 18 2026  Read the optional TAC window of the nhit cut
+// K Labe - October 18 2026  Read the optional charge sum cut
+// K Labe - October 18 2026  Read the optional flasher tagger
+// K Labe - October 18 2026  Read the optional output rate control
+// K Labe - October 18 2026  Read the optional dropping of duplicates
+// K Labe - October 18 2026  Read all the optional parameters from one table
 
 #include "struct.h"
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
 #include <fstream>
 #include <string.h>
+#include <stdio.h>
 
 // Number of parameters held by the configuration object
 static const int paramn = 11;
@@ -66,6 +77,193 @@ void SetConfig(int runtype, configuration allconfigs[2], configuration & config)
   config.burstsize    = allconfigs[configno].burstsize;
   config.endrate      = allconfigs[configno].endrate;
   config.bitmask      = allconfigs[configno].bitmask;
+  config.nwindows     = allconfigs[configno].nwindows;
+  for(int i=0; i<MAXWINDOWS; i++){
+    config.windowlen[i]  = allconfigs[configno].windowlen[i];
+    config.windowsize[i] = allconfigs[configno].windowsize[i];
+    config.windowend[i]  = allconfigs[configno].windowend[i];
+    config.windowfile[i] = allconfigs[configno].windowfile[i];
+  }
+  config.prescale     = allconfigs[configno].prescale;
+  config.nprescales   = allconfigs[configno].nprescales;
+  for(int i=0; i<MAXPRESCALES; i++){
+    config.prescalenhit[i] = allconfigs[configno].prescalenhit[i];
+    config.prescaletier[i] = allconfigs[configno].prescaletier[i];
+  }
+  config.tacwindow    = allconfigs[configno].tacwindow;
+  config.chargetype   = allconfigs[configno].chargetype;
+  config.chargecut    = allconfigs[configno].chargecut;
+  config.flashernhit  = allconfigs[configno].flashernhit;
+  config.flashercrate = allconfigs[configno].flashercrate;
+  config.flashercard  = allconfigs[configno].flashercard;
+  config.ratetarget   = allconfigs[configno].ratetarget;
+  config.maxoffset    = allconfigs[configno].maxoffset;
+  config.dropduplicates = allconfigs[configno].dropduplicates;
+}
+
+// An optional parameter.  A numbered parameter is given once for each of
+// count things, as its name followed by a number from 1 to count, and sets
+// an array of count ints.  The parameters of a group must be given together
+// (for the same number), except those marked optional, and the numbers given
+// must run from 1 with no gaps; their count is kept in the int at ngiven.
+// Parameters not given are 0.  A new optional parameter is one more row.
+struct optparam
+{
+const char* name;
+size_t field;       // Offset in the configuration of the int or array set
+int count;          // 0 for a single parameter, or the size of the array
+const char* group;  // Name of the parameters which must be given together
+bool optional;      // Whether it may be left out of its group
+int min, max;       // The values allowed
+size_t ngiven;      // Offset of the count of numbers given, if numbered
+};
+
+#define FIELD(f) offsetof(configuration, f)
+static const optparam optparams[] = {
+  // Extra burst windows; burstfileN set to 1 also writes burst files
+  {"burstwindow",  FIELD(windowlen),    MAXWINDOWS,   "burst window",
+   false, 1, INT_MAX, FIELD(nwindows)},
+  {"burstsize",    FIELD(windowsize),   MAXWINDOWS,   "burst window",
+   false, INT_MIN, INT_MAX, FIELD(nwindows)},
+  {"endrate",      FIELD(windowend),    MAXWINDOWS,   "burst window",
+   false, INT_MIN, INT_MAX, FIELD(nwindows)},
+  {"burstfile",    FIELD(windowfile),   MAXWINDOWS,   "burst window",
+   true, INT_MIN, INT_MAX, FIELD(nwindows)},
+  // Prescale of events in no tier, and the nhit dependent tiers
+  {"prescale",     FIELD(prescale),     0,            "prescale",
+   false, 0, INT_MAX, 0},
+  {"prescalenhit", FIELD(prescalenhit), MAXPRESCALES, "prescale tier",
+   false, INT_MIN, INT_MAX, FIELD(nprescales)},
+  {"prescale",     FIELD(prescaletier), MAXPRESCALES, "prescale tier",
+   false, 0, INT_MAX, FIELD(nprescales)},
+  // Window of in-time hits for the nhit cut; 0 counts every hit
+  {"tacwindow",    FIELD(tacwindow),    0, "in-time nhit window",
+   false, 0, 4096, 0},
+  // Charge sum cut; a charge type of 0 turns it off
+  {"chargetype",   FIELD(chargetype),   0, "charge sum cut",
+   false, 0, 3, 0},
+  {"chargesum",    FIELD(chargecut),    0, "charge sum cut",
+   false, INT_MIN, INT_MAX, 0},
+  // Flasher tagger; an nhit of 0 turns it off
+  {"flashernhit",  FIELD(flashernhit),  0, "flasher tagger",
+   false, 0, INT_MAX, 0},
+  {"flashercrate", FIELD(flashercrate), 0, "flasher tagger",
+   false, 0, 100, 0},
+  {"flashercard",  FIELD(flashercard),  0, "flasher tagger",
+   false, 0, 100, 0},
+  // Output rate control; a target of 0 turns it off
+  {"ratetarget",   FIELD(ratetarget),   0, "output rate control",
+   false, 0, INT_MAX, 0},
+  {"maxoffset",    FIELD(maxoffset),    0, "output rate control",
+   false, 0, INT_MAX, 0},
+  // Dropping of exact duplicates of events, by GTID
+  {"dropduplicates", FIELD(dropduplicates), 0, "dropping of duplicates",
+   false, 0, 1, 0},
+};
+#undef FIELD
+
+static const int noptparams = sizeof(optparams)/sizeof(optparams[0]);
+static const int maxnumbered = MAXWINDOWS > MAXPRESCALES ? MAXWINDOWS :
+                                                           MAXPRESCALES;
+
+// This function returns the int set by optional parameter p for number k
+static int* OptField(configuration & config, const optparam & p, const int k){
+  return (int*) ((char*) &config + p.field) + k;
+}
+
+// This function sets every optional parameter to 0
+static void ClearOptional(configuration & config){
+  for(int i=0; i<noptparams; i++){
+    const int n = optparams[i].count ? optparams[i].count : 1;
+    for(int k=0; k<n; k++)
+      *OptField(config, optparams[i], k) = 0;
+  }
+}
+
+// This function reads param if it is an optional parameter, and returns
+// false if it is not.  It aborts if it was set already or is out of range.
+static bool ReadOptional(const char* param, const int value,
+                         configuration & config, bool set[][maxnumbered]){
+  for(int i=0; i<noptparams; i++){
+    const optparam & p = optparams[i];
+    const size_t len = strlen(p.name);
+    if(strncmp(param, p.name, len))
+      continue;
+    long k = 0;
+    if(p.count){
+      char* end;
+      if(!param[len])
+        continue;
+      k = strtol(param + len, &end, 10) - 1;
+      if(*end || k < 0 || k >= p.count)
+        continue;
+    }
+    else if(param[len])
+      continue;
+    if(set[i][k]){
+      printf("Tried to set a parameter twice!\n");
+      exit(1);
+    }
+    if(value < p.min || value > p.max){
+      if(p.max == INT_MAX)
+        printf("%s must be at least %d!\n", param, p.min);
+      else
+        printf("%s must be from %d to %d!\n", param, p.min, p.max);
+      exit(1);
+    }
+    set[i][k] = true;
+    *OptField(config, p, k) = value;
+    return true;
+  }
+  return false;
+}
+
+// This function checks that each group of optional parameters is fully
+// given, or not at all, with numbers from 1 and no gaps, and counts the
+// numbers given of each numbered group.
+static void CheckOptional(configuration & config, bool set[][maxnumbered]){
+  for(int i=0; i<noptparams; i++){
+    // Check each group once, at its first parameter
+    const optparam & first = optparams[i];
+    int j = 0;
+    while(strcmp(optparams[j].group, first.group))
+      j++;
+    if(j != i)
+      continue;
+    const int n = first.count ? first.count : 1;
+    int given = 0;
+    for(int k=0; k<n; k++){
+      bool any = false, all = true;
+      for(j=i; j<noptparams; j++){
+        if(strcmp(optparams[j].group, first.group))
+          continue;
+        any = any || set[j][k];
+        all = all && (set[j][k] || optparams[j].optional);
+      }
+      if(!any)
+        continue;
+      if(!all || k != given){
+        if(first.count)
+          printf("The configuration file did not fully specify %s %d!\n",
+                 first.group, k+1);
+        else
+          printf("The configuration file did not fully specify the %s!\n",
+                 first.group);
+        exit(1);
+      }
+      given++;
+    }
+    if(first.count)
+      *(int*) ((char*) &config + first.ngiven) = given;
+  }
+
+  // The prescale tiers must also be in order of nhit
+  for(int k=1; k<config.nprescales; k++){
+    if(config.prescalenhit[k] <= config.prescalenhit[k-1]){
+      printf("The prescale tiers must be in increasing nhit!\n");
+      exit(1);
+    }
+  }
 }
 
 // This function reads the configuration file and writes the results in the
@@ -83,6 +281,9 @@ void ReadConfig(const char* filename, configuration allconfigs[2]){
   resetstate();
   // Read file and check that each parameter set exactly once
   for(int i=0; i<2; i++){
+    bool optset[noptparams][maxnumbered];
+    memset(optset, 0, sizeof(optset));
+    ClearOptional(allconfigs[i]);
     while(fscanf(configfile, "%s %d %d\n", param, &value[0], &value[1])==3){
       if     (!strcmp(param, "nhithi")      )
         {allconfigs[i].nhithi       = value[i]; bit(0);}
@@ -105,6 +306,7 @@ void ReadConfig(const char* filename, configuration allconfigs[2]){
       else if(!strcmp(param, "endrate")     )
         {allconfigs[i].endrate      = value[i]; bit(9);}
       else if(!strcmp(param, "bitmask")     ){;} // Do nothing
+      else if(ReadOptional(param, value[i], allconfigs[i], optset)){;}
       else{
          printf("ReadConfig does not recognize parameter %s.  Ignoring.\n",
                 param);
@@ -121,6 +323,7 @@ void ReadConfig(const char* filename, configuration allconfigs[2]){
       printf("The configuration file did not set all the parameters!\n");
       exit(1);
     }
+    CheckOptional(allconfigs[i], optset);
     rewind(configfile);
     resetstate();
   }
@@ -1,12 +1,14 @@
 // Curl connection code
 //
 // K Labe September 23 2014
+// K Labe October 18 2026   Serialize alarms, which may come from any thread
 
 #include "curl.h"
 #include "curl/curl.h"
 #include <cstring>
 #include <stdlib.h>
 #include <stdint.h>
+#include <pthread.h>
 
 static CURL* curl; // curl connection object
 static const int max[5] = {5, 3, 2, 5, 1}; // maximum number of curl messages allowed per second
@@ -17,6 +19,9 @@ static bool silent = false; // Whether to set alarms
 static const int ALARMTYPES = 16; // This should be the number of error alarm types
 static uint64_t alarmtimes[ALARMTYPES]; // Array of timestamps of alarms
 static const int ERRORRATE= 10; // Seconds between alarms
+static pthread_mutex_t curllock = PTHREAD_MUTEX_INITIALIZER; // Guards the above
+
+static void FlushLocked();
 
 // This function return alarm_type from tony's log number
 alarm_type type(const int level){
@@ -35,9 +40,10 @@ alarm_type type(const int level){
 // This function sends alarms to the monitoring website
 void alarm(const int level, const char* msg, const int id){
   if(!silent){
+    pthread_mutex_lock(&curllock);
     int walltime = time(NULL);
     if(walltime != oldwalltime)
-      Flusherrors();
+      FlushLocked();
     alarmn[type(level)]++;
     if(alarmn[type(level)] > max[type(level)]) 
       overflow[type(level)]++;
@@ -62,11 +68,19 @@ void alarm(const int level, const char* msg, const int id){
           fprintf(stderr, "Logging failed: %s\n", curl_easy_strerror(res));
       }
     }
+    pthread_mutex_unlock(&curllock);
   }
 }
 
 // This function flushes the error buffer when necessary
 void Flusherrors(){
+  pthread_mutex_lock(&curllock);
+  FlushLocked();
+  pthread_mutex_unlock(&curllock);
+}
+
+// This function flushes the error buffer, with the lock held
+static void FlushLocked(){
   int overflowsum = 0;
   for(int i=0; i<5; i++){
     overflowsum += overflow[i];
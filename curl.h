@@ -5,6 +5,7 @@
 // K Labe, Setpember 29 2014 - add enum of types and function for it
 // K Labe, October 17 2014   - add Flusherrors function
 // K Labe, December 5 2014   - add setsilent function
+// K Labe, October 18 2026   - alarm and Flusherrors are thread-safe
 
 enum alarm_type {DEBUG, INFO, SUCCESS, WARNING, ERROR};
 
@@ -18,7 +19,8 @@ void Opencurl(char* password);
 // This closes the connection to minard
 void Closecurl();
 
-// This function is used to send an alarm or log a message
+// This function is used to send an alarm or log a message.  It may be
+// called from any thread.
 // level sets the alarm type (see minard documentation)
 // msg is the accompanying message (include &notify to alarm)
 // id is a unique identifier for each message of level ERROR
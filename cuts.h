@@ -0,0 +1,254 @@
+// L2 Cuts Header
+//
+// K Labe, October 18 2026
+// K Labe, October 18 2026 - Add the prescale cut
+// K Labe, October 18 2026 - Take the stateless tests from flags worked out
+//                           in advance for a batch of events
+// K Labe, October 18 2026 - Count only the hits within the TAC window in the
+//                           nhit cut, if there is one
+// K Labe, October 18 2026 - Add the charge sum cut
+// K Labe, October 18 2026 - Add the flasher flag
+// K Labe, October 18 2026 - Give the counters to checkpoints
+// K Labe, October 18 2026 - Add ApplyFirst() to try only the leading cuts
+
+// Each L2 cut is a small type with a name and a static Pass() function which
+// says whether an event passes it.  A CutChain of cut types is evaluated as a
+// single inlined function: every cut is tried, with no branching between
+// them, and the cuts passed are returned as a bitmask with cut i in bit i.
+// An event is kept if it passes any cut.  The counters keep the number of
+// events for each combination of cuts passed, from which the passes, fails
+// and overlaps of each cut follow, for any number of cuts.  Cuts take their
+// parameters from the configuration.
+//
+// The tests which depend only on the event and the configuration are made
+// beforehand, for a whole batch of events at once, and given to the cuts as
+// flags.  The rest depend on the events before, and are made in order.
+
+// Flags of the tests which depend only on the event and the configuration
+enum eventflag {
+  kExtTrig      = 1 << 0,  // An external trigger in the bitmask
+  kOverRetrig   = 1 << 1,  // Over the retrigger nhit threshold
+  kOverLothresh = 1 << 2,  // Large enough to lower the nhit cut
+  kBurstCand    = 1 << 3,  // A burst candidate: over the burst nhit threshold
+                           // and without an external trigger
+  kFlasher      = 1 << 4   // Dominated by one crate or card (set with the hit
+                           // counts, and never a burst candidate)
+};
+
+// This function returns the flags of an event.  The batched version in
+// l2engine.cpp must give the same answers.
+static inline uint8_t EventFlags(const configuration & c, const uint16_t nhit,
+                                 const uint32_t word){
+  const bool ext = (word & c.bitmask) != 0;
+  return (ext ? kExtTrig : 0) |
+         (nhit > c.retrigcut ? kOverRetrig : 0) |
+         (nhit > c.lothresh ? kOverLothresh : 0) |
+         (nhit > c.nhitbcut && !ext ? kBurstCand : 0);
+}
+
+// What the cuts know about an event
+struct cutevent
+{
+uint16_t nhit;
+uint32_t word;          // Trigger word
+uint8_t flags;          // Flags of the stateless tests (see eventflag)
+uint16_t intime;        // Hits within the TAC window (see pmthits.h)
+int charge;             // Summed charge less pedestals (see pmthits.h)
+bool passretrig;        // Whether the previous event was kept
+bool retrig;            // Whether the event is a retrigger
+int nhitcut;            // The current nhit cut (Hi or Lo)
+const configuration* config;
+counts* count;          // Counters of the engine, for the prescale
+};
+
+// Keep events over the current nhit threshold.  If there is a TAC window,
+// only the hits within it count, so that late noise hits do not.
+struct NhitCut
+{
+static const char* Name() { return "nhit"; }
+static bool Pass(const cutevent & ev) {
+  return (ev.config->tacwindow > 0 ? ev.intime : ev.nhit) > ev.nhitcut;
+}
+};
+
+// Keep events with a large summed charge, whatever their nhit
+struct ChargeCut
+{
+static const char* Name() { return "charge sum"; }
+static bool Pass(const cutevent & ev) {
+  return ev.config->chargetype > 0 && ev.charge > ev.config->chargecut;
+}
+};
+
+// Keep events with an external trigger in the bitmask
+struct ExtTrigCut
+{
+static const char* Name() { return "external trigger"; }
+static bool Pass(const cutevent & ev) {
+  return ev.flags & kExtTrig;
+}
+};
+
+// Keep retriggers of a kept event over the retrigger nhit threshold
+struct RetrigCut
+{
+static const char* Name() { return "retrigger"; }
+static bool Pass(const cutevent & ev) {
+  return ev.passretrig && ev.retrig && (ev.flags & kOverRetrig);
+}
+};
+
+// Keep 1 in N events, where N is the fraction of the first prescale tier
+// whose nhit limit is above the event's nhit, or the untiered fraction if
+// there is none.  A fraction of 0 keeps nothing.
+struct PrescaleCut
+{
+static const char* Name() { return "prescale"; }
+static bool Pass(const cutevent & ev) {
+  const configuration & c = *ev.config;
+  int k = 0;
+  while(k < c.nprescales && ev.nhit >= c.prescalenhit[k])
+    k++;
+  if(k == c.nprescales)
+    k = MAXPRESCALES;
+  const int n = k < MAXPRESCALES ? c.prescaletier[k] : c.prescale;
+  return n > 0 && ++ev.count->prescalen[k] % n == 0;
+}
+};
+
+// This evaluates the cuts from number I on, and returns their bitmask
+template<int I, typename... Cuts> struct CutBits;
+
+template<int I> struct CutBits<I>
+{
+static uint32_t Eval(const cutevent &) { return 0; }
+static void Names(const char* []) {}
+};
+
+template<int I, typename Cut, typename... Rest> struct CutBits<I, Cut, Rest...>
+{
+static uint32_t Eval(const cutevent & ev) {
+  return (uint32_t(Cut::Pass(ev)) << I) | CutBits<I+1, Rest...>::Eval(ev);
+}
+static void Names(const char* names[]) {
+  names[I] = Cut::Name();
+  CutBits<I+1, Rest...>::Names(names);
+}
+};
+
+// This evaluates the cuts from number I on which come before number N, and
+// returns their bitmask.  The test of I against N is made at compile time.
+template<int N, int I, typename... Cuts> struct FirstBits
+{
+static uint32_t Eval(const cutevent &) { return 0; }
+};
+
+template<int N, int I, typename Cut, typename... Rest>
+struct FirstBits<N, I, Cut, Rest...>
+{
+static uint32_t Eval(const cutevent & ev) {
+  return I < N ? (uint32_t(Cut::Pass(ev)) << I) |
+                 FirstBits<N, I+1, Rest...>::Eval(ev) : 0;
+}
+};
+
+// This finds the bit of cut type C among the cuts from number I on
+template<typename C, int I, typename... Cuts> struct CutIndex;
+
+template<typename C, int I, typename... Rest>
+struct CutIndex<C, I, C, Rest...> { static const int value = I; };
+
+template<typename C, int I, typename Cut, typename... Rest>
+struct CutIndex<C, I, Cut, Rest...>
+{
+static const int value = CutIndex<C, I+1, Rest...>::value;
+};
+
+// A chain of cuts, with its counters
+template<typename... Cuts> class CutChain {
+public:
+  static const int ncuts = sizeof...(Cuts);
+  static const int nkeys = 1 << ncuts;
+
+  CutChain() { Reset(); }
+
+  // The bit of cut type C in the bitmask
+  template<typename C> static uint32_t Bit() {
+    return 1u << CutIndex<C, 0, Cuts...>::value;
+  }
+
+  // This function evaluates every cut, counts the event, and returns the
+  // bitmask of cuts passed
+  uint32_t Apply(const cutevent & ev) {
+    const uint32_t key = CutBits<0, Cuts...>::Eval(ev);
+    keys[key]++;
+    return key;
+  }
+
+  // This function does the same when every cut from number N on is known
+  // to fail, as when the configuration turns them off, trying only the
+  // first N.  The bitmask and counters are those Apply() would give.
+  template<int N> uint32_t ApplyFirst(const cutevent & ev) {
+    const uint32_t key = FirstBits<N, 0, Cuts...>::Eval(ev);
+    keys[key]++;
+    return key;
+  }
+
+  void Reset() {
+    for(int i=0; i<nkeys; i++)
+      keys[i] = 0;
+  }
+
+  // Events which passed exactly the cuts in the bitmask key
+  uint64_t Key(const uint32_t key) const { return keys[key]; }
+
+  // The nkeys counters, to be written to and read from checkpoints
+  uint64_t* Keys() { return keys; }
+
+  // Events which passed cut i, and both cuts i and j
+  uint64_t Passed(const int i) const { return Overlap(i, i); }
+  uint64_t Overlap(const int i, const int j) const {
+    uint64_t n = 0;
+    for(int k=0; k<nkeys; k++)
+      if((k >> i & 1) && (k >> j & 1))
+        n += keys[k];
+    return n;
+  }
+  uint64_t Total() const {
+    uint64_t n = 0;
+    for(int k=0; k<nkeys; k++)
+      n += keys[k];
+    return n;
+  }
+
+  static const char* Name(const int i) {
+    const char* names[ncuts];
+    CutBits<0, Cuts...>::Names(names);
+    return names[i];
+  }
+
+  // This function writes a line for each cut, with its passes, fails and
+  // overlaps with the other cuts, to the buffer messg of size len
+  void Summary(char* messg, size_t len) const {
+    const uint64_t total = Total();
+    for(int i=0; i<ncuts && len > 1; i++){
+      int n = snprintf(messg, len, "%s cut: %lu pass, %lu fail", Name(i),
+                       (unsigned long) Passed(i),
+                       (unsigned long) (total - Passed(i)));
+      for(int j=0; j<ncuts; j++){
+        if(j != i && n >= 0 && (size_t) n < len)
+          n += snprintf(messg + n, len - n, ", %lu with %s",
+                        (unsigned long) Overlap(i, j), Name(j));
+      }
+      if(n >= 0 && (size_t) n < len)
+        n += snprintf(messg + n, len - n, "\n");
+      if(n < 0 || (size_t) n >= len)
+        return;
+      messg += n;
+      len -= n;
+    }
+  }
+
+private:
+  uint64_t keys[nkeys];
+};
@@ -0,0 +1,109 @@
+// GTID Tracker Code
+//
+// K Labe October 18 2026
+// K Labe October 18 2026   Write and read the tracker in checkpoints
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "ckptio.h"
+#include "gtidtrack.h"
+
+// Rollover of the GTID counter
+static const uint32_t GTIDMASK = 0xffffff;
+static const int32_t GTIDHALF = 0x800000;
+
+// This function forgets every GTID seen
+void GTIDTracker::Reset(){
+  started = false;
+  run = 0;
+  first = 0;
+  latest = 0;
+  memset(seen, 0, sizeof(seen));
+  memset(fingerprints, 0, sizeof(fingerprints));
+}
+
+// This function records GTID g as seen, with the fingerprint of its event
+void GTIDTracker::Mark(const uint64_t g, const uint64_t fingerprint){
+  const int slot = g % GTIDWINDOW;
+  seen[slot/64] |= 1ULL << (slot % 64);
+  fingerprints[slot] = fingerprint;
+}
+
+// This function moves the window on to end at GTID to.  Each GTID leaving
+// the window, or passed over entirely, which never arrived is lost.
+void GTIDTracker::Advance(const uint64_t to, uint64_t & lost){
+  const uint64_t d = to - latest;
+  const uint64_t n = d < (uint64_t) GTIDWINDOW ? d : GTIDWINDOW;
+  for(uint64_t k=1; k<=n; k++){
+    // GTID latest + k takes the slot of the GTID a window before it
+    const uint64_t g = latest + k;
+    const int slot = g % GTIDWINDOW;
+    const uint64_t bit = 1ULL << (slot % 64);
+    if(!(seen[slot/64] & bit) && g >= first + GTIDWINDOW)
+      lost++;
+    seen[slot/64] &= ~bit;
+  }
+  if(d > (uint64_t) GTIDWINDOW)
+    lost += d - GTIDWINDOW;
+  latest = to;
+}
+
+// This function places the event in the window
+int GTIDTracker::Add(const uint32_t gtid, const uint32_t newrun,
+                     const uint64_t fingerprint, uint64_t & lost){
+  if(!started || newrun != run){
+    // The GTIDs missing from the run before are lost
+    lost += Missing();
+    Reset();
+    started = true;
+    run = newrun;
+    first = latest = gtid & GTIDMASK;
+    Mark(latest, fingerprint);
+    return kGTIDNew;
+  }
+
+  // The GTID relative to the latest, allowing for the rollover
+  const int32_t d = (int32_t) ((gtid - (uint32_t) latest + GTIDHALF) &
+                               GTIDMASK) - GTIDHALF;
+  if(d > 0){
+    Advance(latest + d, lost);
+    Mark(latest, fingerprint);
+    return kGTIDNew;
+  }
+  const uint64_t back = -(int64_t) d;
+  if(back >= (uint64_t) GTIDWINDOW || back > latest - first)
+    return kGTIDLate;
+
+  const uint64_t g = latest - back;
+  const int slot = g % GTIDWINDOW;
+  if(seen[slot/64] & (1ULL << (slot % 64)))
+    return fingerprints[slot] == fingerprint ? kGTIDExact : kGTIDDuplicate;
+  Mark(g, fingerprint);
+  return kGTIDLate;
+}
+
+// This function counts the GTIDs in the window which have not arrived
+uint64_t GTIDTracker::Missing() const{
+  if(!started)
+    return 0;
+  const uint64_t n = latest - first < (uint64_t) GTIDWINDOW ?
+                     latest - first + 1 : GTIDWINDOW;
+  uint64_t missing = 0;
+  for(uint64_t k=0; k<n; k++){
+    const int slot = (latest - k) % GTIDWINDOW;
+    if(!(seen[slot/64] & (1ULL << (slot % 64))))
+      missing++;
+  }
+  return missing;
+}
+
+// This function writes or reads the tracker in a checkpoint
+void GTIDTracker::CheckpointFields(ckptfile & c){
+  Field(c, started);
+  Field(c, run);
+  Field(c, first);
+  Field(c, latest);
+  Fields(c, seen, GTIDWINDOW/64);
+  Fields(c, fingerprints, GTIDWINDOW);
+}
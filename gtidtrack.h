@@ -0,0 +1,61 @@
+// GTID Tracker Header
+//
+// K Labe, October 18 2026
+// K Labe, October 18 2026 - Add CheckpointFields()
+
+// A GTIDTracker follows the GTIDs of the events of a stream, to count those
+// lost before they reached the filter, those seen twice, and those which
+// arrive after a later one.  The GTID is a 24-bit counter, so each is placed
+// relative to the latest seen, allowing for the rollover.  A bitmap of the
+// last GTIDWINDOW GTIDs records those seen, so that a GTID is only counted
+// as lost once it has left the window without arriving; one further back
+// still is taken to be late.  A change of run starts the tracker again.
+//
+// With each GTID in the window is kept a fingerprint of its event, so that an
+// exact duplicate, which has the same fingerprint, may be told from another
+// event given the same GTID.
+
+// The number of GTIDs before the latest within which arrivals are placed
+static const int GTIDWINDOW = 4096;
+
+struct ckptfile;
+
+// What the tracker makes of an event
+enum gtidresult {
+  kGTIDNew,        // Later than any GTID seen
+  kGTIDLate,       // Earlier than the latest, and not seen, or too old to tell
+  kGTIDDuplicate,  // Already seen, with a different fingerprint
+  kGTIDExact       // Already seen, with the same fingerprint
+};
+
+class GTIDTracker {
+public:
+  GTIDTracker() { Reset(); }
+
+  // This function forgets every GTID seen
+  void Reset();
+
+  // This function places the event with GTID gtid of run run, and the given
+  // fingerprint, and returns a gtidresult.  Lost is increased by the GTIDs
+  // which left the window without arriving.
+  int Add(const uint32_t gtid, const uint32_t run, const uint64_t fingerprint,
+          uint64_t & lost);
+
+  // This function returns the GTIDs in the window which have not arrived,
+  // to be counted as lost at the end of the stream.
+  uint64_t Missing() const;
+
+  // This function writes or reads the tracker in a checkpoint (see ckptio.h)
+  void CheckpointFields(ckptfile & c);
+
+private:
+  void Advance(const uint64_t to, uint64_t & lost);
+  void Mark(const uint64_t g, const uint64_t fingerprint);
+
+  bool started;
+  uint32_t run;
+  uint64_t first;       // The first GTID seen, counting rollovers
+  uint64_t latest;      // The latest GTID seen, counting rollovers
+  uint64_t seen[GTIDWINDOW/64];
+  uint64_t fingerprints[GTIDWINDOW];
+};
@@ -0,0 +1,953 @@
+// L2 Engine Code
+//
+// K Labe October 18 2026
+// K Labe October 18 2026   Apply the L2 cuts as a chain of cut types
+// K Labe October 18 2026   Count the events kept by the prescale
+// K Labe October 18 2026   Process records in batches, decoding the events
+//                          and making the stateless tests for all at once
+// K Labe October 18 2026   Count the hits in the TAC window for the nhit
+//                          cut
+// K Labe October 18 2026   Sum the charges for the charge cut
+// K Labe October 18 2026   Keep events tagged as flashers out of bursts
+// K Labe October 18 2026   Add the output rate control of the nhit offset
+// K Labe October 18 2026   Track the GTIDs, and drop exact duplicates
+// K Labe October 18 2026   Count records written and bursts opened by every
+//                          engine
+// K Labe October 18 2026   Let the primary go on to the next subfile, and
+//                          keep the database connection open
+// K Labe October 18 2026   Write and read the state of the engine in
+//                          checkpoints
+
+// The engine is the body of the main loop of stonehenge, with the state which
+// was kept at file scope there moved into the engine.
+
+#include "PZdabFile.h"
+#include "PZdabWriter.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <deque>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <libpq-fe.h>
+#include "redis.h"
+#include "curl.h"
+#include "config.h"
+#include "ckptio.h"
+#include "snbuf.h"
+#include "snwin.h"
+#include "snhist.h"
+#include "pmthits.h"
+#include "cuts.h"
+#include "gtidtrack.h"
+#include "l2engine.h"
+
+// the builder won't put out events with NHIT > 10000
+// (note that these are possible due to hardware problems)
+// but XSNOED can write an event with up to 10240 channels
+#define MAX_NHIT            10240
+#define MAX_BUFFSIZE        0x400000UL  // maximum size of zdab record buffer (4 MB)
+
+// Tells us when the 50MHz clock rolls over
+static const uint64_t maxtime = (1UL << 43);
+
+// Maximum time allowed between events without a complaint
+static const uint64_t maxjump = 10*50000000; // 50 MHz time
+
+// Maximum time drift allowed between two clocks without a complaint
+static const int maxdrift = 5000; // 50 MHz ticks (1 us)
+
+// Time over which the output rate is measured by the rate control
+static const uint64_t rateinterval = 50000000; // 50 MHz ticks (1 s)
+
+// This function zeros out the counters
+static counts CountInit(){
+  counts count;
+  for(int i=0; i<MAXPRESCALES+1; i++)
+    count.prescalen[i] = 0;
+  count.eventn = 0;
+  count.recordn = 0;
+  count.flashern = 0;
+  count.gtidlost = 0;
+  count.gtidlate = 0;
+  count.gtiddup = 0;
+  count.gtiddropped = 0;
+  count.writtenn = 0;
+  count.writtenbytes = 0;
+  count.burstn = 0;
+  return count;
+}
+
+// This function initialzes the time object
+static alltimes InitTime(){
+  alltimes alltime;
+  alltime.walltime = 0;
+  alltime.oldwalltime = 0;
+  alltime.exptime = 0;
+  alltime.epoch = 0;
+  return alltime;
+}
+
+// This function just puts a bunch of zeros in a hitinfo struct
+// to initialize it
+static hitinfo InitHit(){
+  hitinfo hit;
+  hit.time50 = 0;
+  hit.time10 = 0;
+  hit.triggertype = 0;
+  hit.nhit = 0;
+  hit.reclen = 0;
+  hit.gtid = 0;
+  hit.run = 0;
+  return hit;
+}
+
+// This function reads out the information about each event that we need
+// for making decisions/processing.
+// This is based on PZdabFile::GetPmtRecord but it does not modify the
+// record, which stays in its external format.
+// If the function is passed a non ZDAB_RECORD it returns false.
+static bool ReadHits(const nZDAB* const zrec, hitinfo & hit){
+  // Check that the record is a ZDAB bank
+  if( zrec->bank_name != ZDAB_RECORD ){
+    return false;
+  }
+
+  // The record is shared with the burst buffer and the writers, so it is
+  // left in its external format; the header is swapped in a local copy
+  PmtEventRecord pmtEvent;
+  memcpy(&pmtEvent, zrec + 1, sizeof(pmtEvent));
+  SWAP_PMT_RECORD( &pmtEvent );
+
+  // Read nhit and check that it is sensible
+  // If not, throw alarm and return empty object
+  hit.nhit = pmtEvent.NPmtHit;
+  if(hit.nhit > MAX_NHIT){
+    fprintf(stderr, "Read error: Bad ZDAB -- %d pmt hit!\x07\n", hit.nhit);
+    alarm(30, "Too many hits found!\n", 0);
+    return false;
+  }
+
+  // Read the gtid and run number
+  hit.gtid = pmtEvent.TriggerCardData.BcGT;
+  hit.run  = pmtEvent.RunNumber;
+
+  // Read the 50 MHz and 10 MHz clock times
+  // This method copied from PZdabFile
+  hit.time50 = (uint64_t(pmtEvent.TriggerCardData.Bc50_2) << 11)
+                        + pmtEvent.TriggerCardData.Bc50_1;
+  hit.time10 = (uint64_t(pmtEvent.TriggerCardData.Bc10_2) << 32)
+                        + pmtEvent.TriggerCardData.Bc10_1;
+
+  // Next retrieve the trigger word
+  // This method copied from zdab_convert
+  uint32_t mtcwords[6];
+  memcpy(mtcwords, &(pmtEvent.TriggerCardData), 6*sizeof(uint32_t));
+  hit.triggertype = ((mtcwords[3] & 0xff000000) >> 24) |
+                    ((mtcwords[4] & 0x3ffff) << 8);
+
+  // Then report the length of the record in words
+  // 9 words for nZDAB, 11 words for PmtEventRecord, 3 words per nhit
+  // plus the length of any subrecords
+  // This method copied from PZdabFile
+  uint32_t event_size = 20 + 3*hit.nhit;
+  const uint32_t* sub_header = (const uint32_t*) (zrec + 1) +
+               (&pmtEvent.CalPckType - (uint32_t*) &pmtEvent);
+  uint32_t sub = pmtEvent.CalPckType;
+  while( sub & SUB_NOT_LAST ){
+    uint32_t jump = (sub & SUB_LENGTH_MASK);
+    if( jump > MAX_BUFFSIZE/4 ){
+      fprintf(stderr, "Error: wanted to jump past the end of the buffer\n");
+      return true;
+    }
+    sub_header += jump;
+    sub = *sub_header;
+    SWAP_INT32(&sub, 1);
+    event_size += (sub & SUB_LENGTH_MASK);
+  }
+  hit.reclen = event_size;
+  return true;
+}
+
+// This function limits a threshold to the range of a signed 16 bit word, for
+// comparison with nhits, which are never above MAX_NHIT
+static inline int16_t Clamp16(const int threshold){
+  return threshold < -32768 ? -32768 : (threshold > 32767 ? 32767 : threshold);
+}
+
+// This function works out the flags (see cuts.h) of events first to n-1 of
+// a batch, and their hits in the TAC window and summed charges if the
+// configuration has cuts on them.  Events dominated by one crate or card
+// are tagged as flashers, and are not burst candidates.
+// Eight events are tested at a time with SSE2 where it is available; the
+// rest, or all without it, with EventFlags().
+static void FlagBatch(const configuration & c, l2batch & batch,
+                      const int first, const int n){
+  int i = first;
+#ifdef __SSE2__
+  const __m128i retrigcut = _mm_set1_epi16(Clamp16(c.retrigcut));
+  const __m128i lothresh  = _mm_set1_epi16(Clamp16(c.lothresh));
+  const __m128i nhitbcut  = _mm_set1_epi16(Clamp16(c.nhitbcut));
+  const __m128i bitmask   = _mm_set1_epi32(c.bitmask);
+  const __m128i zero      = _mm_setzero_si128();
+  for(; i+8 <= n; i+=8){
+    const __m128i nhit = _mm_loadu_si128((const __m128i*) (batch.nhit + i));
+    const __m128i word0 = _mm_loadu_si128((const __m128i*) (batch.word + i));
+    const __m128i word1 = _mm_loadu_si128((const __m128i*) (batch.word + i+4));
+    // All ones for the events with no external trigger in the bitmask
+    const __m128i noext = _mm_packs_epi32(
+      _mm_cmpeq_epi32(_mm_and_si128(word0, bitmask), zero),
+      _mm_cmpeq_epi32(_mm_and_si128(word1, bitmask), zero));
+    __m128i flags = _mm_andnot_si128(noext, _mm_set1_epi16(kExtTrig));
+    flags = _mm_or_si128(flags, _mm_and_si128(_mm_cmpgt_epi16(nhit, retrigcut),
+                                              _mm_set1_epi16(kOverRetrig)));
+    flags = _mm_or_si128(flags, _mm_and_si128(_mm_cmpgt_epi16(nhit, lothresh),
+                                              _mm_set1_epi16(kOverLothresh)));
+    flags = _mm_or_si128(flags, _mm_and_si128(
+                _mm_and_si128(_mm_cmpgt_epi16(nhit, nhitbcut), noext),
+                _mm_set1_epi16(kBurstCand)));
+    _mm_storel_epi64((__m128i*) (batch.flags + i), _mm_packus_epi16(flags, zero));
+  }
+#endif
+  for(; i<n; i++)
+    batch.flags[i] = EventFlags(c, batch.nhit[i], batch.word[i]);
+
+  for(i=first; i<n; i++){
+    batch.intime[i] = c.tacwindow > 0 && batch.event[i] ?
+                      InWindowHits(batch.rec[i], batch.nhit[i], c.tacwindow) : 0;
+    batch.charge[i] = c.chargetype > 0 && batch.event[i] ?
+                      ChargeSum(batch.rec[i], batch.nhit[i], c.chargetype) : 0;
+    if(c.flashernhit > 0 && batch.event[i] && batch.nhit[i] >= c.flashernhit){
+      int crate, card;
+      HotCrateCard(batch.rec[i], batch.nhit[i], crate, card);
+      if(100*crate > c.flashercrate*batch.nhit[i] ||
+         100*card > c.flashercard*batch.nhit[i])
+        batch.flags[i] = (batch.flags[i] | kFlasher) & ~kBurstCand;
+    }
+  }
+}
+
+// This function builds an engine which has seen no records
+L2Engine::L2Engine(const configuration all[2]){
+  allconfigs[0] = all[0];
+  allconfigs[1] = all[1];
+  memset(&config, 0, sizeof(config));
+  configknown = false;
+  configtype = 0;
+  optionalcuts = true;
+  NHITCUT = 0;
+  primary = false;
+  yesredis = false;
+  clobber = true;
+  infilename = NULL;
+  outfilebase = NULL;
+  b = -1;
+  ended = false;
+  alltime = InitTime();
+  clockstarted = false;
+  standard = alltime;
+  problem = false;
+  hits = InitHit();
+  passretrig = false;
+  retrig = false;
+  bursting = false;
+  count = CountInit();
+  ResetStatistics(stat);
+  batchn = 0;
+  flagged = 0;
+  nhitoffset = 0;
+  ratestarted = false;
+  ratestart = 0;
+  ratebytes = 0;
+  maxoffsetused = 0;
+  adjustments = 0;
+}
+
+// This function makes the engine the primary.  The clocks carry on from the
+// epoch of the burst buffer saved by the previous subfile.
+void L2Engine::SetPrimary(char* const infile, char* const outbase,
+                          const bool clob, const bool redis){
+  primary = true;
+  infilename = infile;
+  outfilebase = outbase;
+  clobber = clob;
+  yesredis = redis;
+  alltime.epoch = GetEpoch();
+}
+
+// This function says whether the configuration c turns on any of the cuts
+// after the first L2BASICCUTS, which otherwise fail every event.  A cut
+// added to the chain must be added here.
+static bool OptionalCuts(const configuration & c){
+  return c.prescale > 0 || c.nprescales > 0 || c.chargetype > 0;
+}
+
+// This function chooses the configuration for the run type, and sets up
+// what depends on it
+void L2Engine::Configure(const uint32_t runtype){
+  configtype = runtype;
+  SetConfig(runtype, allconfigs, config);
+  optionalcuts = OptionalCuts(config);
+  if(primary){
+    InitializeWindows(config);
+    WriteConfig();
+  }
+  configknown = true;
+}
+
+// This function reads the run type of a RHDR record, or returns 0 for any
+// other record
+static uint32_t RunType(const nZDAB* const zrec){
+  if(zrec->bank_name != RHDR_RECORD)
+    return 0;
+  RunRecord rhdr;
+  memcpy(&rhdr, zrec + 1, sizeof(rhdr));
+  SWAP_INT32(&rhdr, 9);
+  return rhdr.RunMask;
+}
+
+// This function checks unix time to see whether to update the times
+static void updatetime(alltimes & alltime){
+  if(alltime.walltime!=0)
+    alltime.oldwalltime=alltime.walltime;
+  alltime.walltime = (int) time(NULL);
+}
+
+// This function sets the trigger threshold appropriately
+// The "Kalpana" solution
+void L2Engine::setthreshold(const uint8_t flags){
+  if(flags & kOverLothresh){
+    alltime.exptime = alltime.longtime + config.lowindow;
+    NHITCUT = config.nhitlo;
+  }
+  if(alltime.longtime > alltime.exptime){
+    NHITCUT = config.nhithi;
+  }
+}
+
+// This function checks the clocks for various anomalies and raises alarms.
+// It returns true if the event passes the tests, false otherwise
+bool L2Engine::IsConsistent(alltimes & newat, const int dd){
+  // Check for time running backward:
+  if(newat.time50 < standard.time50){
+    // Is it reasonable that the clock rolled over?
+    if((standard.time50 + newat.time50 < maxtime + maxjump) &&
+        dd < maxdrift && (standard.time50 > maxtime - maxjump) ){
+      fprintf(stderr, "New Epoch\n");
+      alarm(20, "Stonehenge: new epoch.", 0);
+      newat.epoch++;
+    }
+    else{
+      const char msg[128] = "Stonehenge: Time running backward!\n";
+      alarm(30, msg, 0);
+      fprintf(stderr, msg);
+      return false;
+    }  
+  }
+  // Check that time has not jumped too far ahead
+  if(newat.time50 - standard.time50 > maxjump){
+    char msg[128] = "Stonehenge: Large time gap between events!\n";
+    alarm(30, msg, 0);
+    fprintf(stderr, msg);
+    return false;
+  }
+  else
+    return true;
+}
+
+// This function calculates the time of an event as measured by the
+// varlous clocks we are interested in.
+void L2Engine::compute_times()
+{
+  const alltimes oldat = alltime;
+  alltimes newat = oldat;
+  // For first event
+  if(!clockstarted){
+    clockstarted = true;
+    newat.time50 = hits.time50;
+    newat.time10 = hits.time10;
+    if(newat.time50 == 0) stat.orphan++;
+    newat.longtime = newat.time50;
+    standard = newat;
+    problem = false;
+    if(primary){
+      Checkbuffer(newat.time50);
+      CheckWindowsStart(newat.time50);
+    }
+  }
+  // Otherwise
+  else{
+    // Get the current 50MHz Clock Time
+    // Implementing Part of Method Get50MHzTime() 
+    // from PZdabFile.cxx
+    newat.time50 = hits.time50;
+
+    // Get the current 10MHz Clock Time
+    // Method taken from zdab_convert.cpp
+    newat.time10 = hits.time10;
+
+    // Check for consistency between clocks
+    const int dd = ( (oldat.time10 - newat.time10)*5 > oldat.time50 - newat.time50 ? 
+                     (oldat.time10 - newat.time10)*5 - (oldat.time50 - newat.time50) :
+                     (oldat.time50 - newat.time50) - (oldat.time10 - newat.time10)*5 );
+    if (dd > maxdrift){
+      char msg[128];
+      sprintf(msg, "Stonehenge: The 50MHz clock jumped by %i ticks relative"
+                   " to the 10MHz clock!\n", dd);
+      alarm(30, msg, 0);
+      fprintf(stderr, msg);
+    }
+
+    // Check for retriggers
+    if (newat.time50 - oldat.time50 > 0 &&
+        newat.time50 - oldat.time50 <= config.retrigwindow){
+      retrig = true;
+    }
+    else{
+      retrig = false;
+      passretrig = false;
+    }
+
+    // Check for pathological case
+    if (newat.time50 == 0){
+      newat.time50 = oldat.time50;
+      stat.orphan++;
+      alltime = newat;
+      return;
+    }
+
+    // Check for well-orderedness
+    if(IsConsistent(newat, dd)){
+      newat.longtime = newat.time50 + maxtime*newat.epoch;
+      standard = newat;
+      problem = false;
+    }
+    else if(problem){
+      // RESET EVERYTHING
+      alarm(40, "Stonehenge: Events out of order - Resetting buffers.", 3);
+      if(primary)
+        ClearBuffer(b, standard.longtime);
+      burstcands.clear();
+      bursting = false;
+      NHITCUT = config.nhithi;
+      newat.epoch = 0;
+      newat.longtime = newat.time50;
+      newat.exptime = 0; 
+      standard = newat;
+      problem = false;
+    }
+    else{
+      problem = true;
+      newat = standard;
+    }
+  }
+  alltime = newat;
+}
+
+// This Function performs the actual L2 cut
+// It returns true if we write out the event and false otherwise
+// Keep event if it passes any cut in the chain (see cuts.h)
+bool L2Engine::l2filter(const int i){
+  cutevent ev;
+  ev.nhit = batch.nhit[i];
+  ev.word = batch.word[i];
+  ev.flags = batch.flags[i];
+  ev.intime = batch.intime[i];
+  ev.charge = batch.charge[i];
+  ev.passretrig = passretrig;
+  ev.retrig = retrig;
+  ev.nhitcut = NHITCUT + nhitoffset;
+  ev.config = &config;
+  ev.count = &count;
+  const uint32_t key = optionalcuts ? cuts.Apply(ev) :
+                                      cuts.ApplyFirst<L2BASICCUTS>(ev);
+  if(key & L2Cuts::Bit<PrescaleCut>())
+    stat.prescale++;
+  if(key & L2Cuts::Bit<ChargeCut>())
+    stat.charge++;
+  return key != 0;
+}
+
+// This function writes the configuration parameters to postgresql
+void L2Engine::WriteConfig(){
+  //TODO: Parse run number and subfile number from infilename
+  char configtext[1024];
+  snprintf(configtext, 1024, "runnumber: %d\n \
+                              subfile: %d\n \
+                              nhithi: %d\n \
+                              nhitlo: %d\n \
+                              lothresh: %d\n \
+                              lowindow: %d\n \
+                              retrigcut: %d\n \
+                              retrigwindow: %d\n \
+                              bitmask: %x\n \
+                              nhitbcut: %d\n \
+                              burstwindow: %d\n \
+                              burstsize: %d\n \
+                              endrate: %d\n",
+           7777, 0, config.nhithi, config.nhitlo, config.lothresh, 
+           config.lowindow, config.retrigcut, config.retrigwindow, 
+           config.bitmask, config.nhitbcut, config.burstwindow, 
+           config.burstsize, config.endrate); 
+
+  char insertstmt[1024];
+  snprintf(insertstmt, 1024, "INSERT into l2 values(%d, %d, %d, %d, %d, \
+                              %d, %d, %d, '%x', %d, %d, %d, %d);",
+           7777, 0, config.nhithi, config.nhitlo, config.lothresh,
+           config.lowindow, config.retrigcut, config.retrigwindow,
+           config.bitmask, config.nhitbcut, config.burstwindow,
+           config.burstsize, config.endrate);
+
+  // The connection is kept for the next run
+  static PGConn* conn = NULL;
+  if(conn == NULL)
+    conn = PQconnectdb("dbname = test");
+  else if(PQstatus(conn) != CONNECTION_OK)
+    PQreset(conn);
+  if( PQstatus(conn) != CONNECTION_OK){
+    alarm(30, "Could not log parameters to database!  Logging here instead.\n", 0);
+    alarm(30, configtext, 0);
+    return;
+  }
+
+  PGresult* res = PQexec(conn, insertstmt);
+  if(PQresultStatus(res) != PGRES_TUPLES_OK){
+    alarm(30, "Could not log parameters to database!  Logging here instead.\n", 0);
+    alarm(30, configtext, 0);
+  }
+  fprintf(stdout, configtext);
+  return;
+}
+
+// This function processes one record
+bool L2Engine::ProcessRecord(nZDAB* const zrec){
+  bool write;
+  ProcessBatch(&zrec, 1, &write);
+  return write;
+}
+
+// This function processes records in batches of up to L2BATCH
+void L2Engine::ProcessBatch(nZDAB* const recs[], const int n, bool write[]){
+  for(int first=0; first<n; first+=L2BATCH){
+    const int m = n - first < L2BATCH ? n - first : L2BATCH;
+    DecodeBatch(recs + first, m);
+    for(int i=0; i<m; i++)
+      write[first+i] = Step(recs[first+i], i);
+  }
+}
+
+// This function decodes the events of a batch of n records
+void L2Engine::DecodeBatch(nZDAB* const recs[], const int n){
+  for(int i=0; i<n; i++){
+    hitinfo hit = InitHit();
+    batch.rec[i] = recs[i];
+    batch.event[i] = ReadHits(recs[i], hit);
+    if(!batch.event[i])
+      hit = InitHit();
+    batch.nhit[i]   = hit.nhit;
+    batch.word[i]   = hit.triggertype;
+    batch.time50[i] = hit.time50;
+    batch.time10[i] = hit.time10;
+    batch.gtid[i]   = hit.gtid;
+    batch.run[i]    = hit.run;
+    batch.reclen[i] = hit.reclen;
+  }
+  batchn = n;
+  flagged = 0;
+}
+
+// This function takes record i of the batch through the sequential part of
+// the decisions, and returns whether it is to be written out
+bool L2Engine::Step(nZDAB* const zrec, const int i){
+  bool write = false;
+
+  // Fill Header buffer if necessary
+  // Check for runtype, configure and record parameters if necessary
+  uint32_t runtype = primary ? FillHeaderBuffer(zrec) : RunType(zrec);
+  if(runtype && !configknown){
+    Configure(runtype);
+  }
+  if(runtype && configknown){
+    alarm(30, "Stonehenge: RHDR Record in the middle of a run!\n", 0);
+  }
+
+  // If the record has an associated time, compute all the time
+  // variables.  Non-hit records don't have times.
+  if(batch.event[i]){
+    hits.nhit        = batch.nhit[i];
+    hits.triggertype = batch.word[i];
+    hits.time50      = batch.time50[i];
+    hits.time10      = batch.time10[i];
+    hits.gtid        = batch.gtid[i];
+    hits.run         = batch.run[i];
+    hits.reclen      = batch.reclen[i];
+    if(!TrackGTID()){
+      count.recordn++;
+      stat.l1++;
+      return false;
+    }
+    count.eventn++;
+    compute_times();
+    if(primary)
+      AddHistory(zrec, alltime.longtime, hits.reclen*sizeof(uint32_t));
+
+    // Write statistics to Redis if necessary
+    updatetime(alltime);
+    if (primary && alltime.walltime!=alltime.oldwalltime){
+      if(yesredis){
+        gtid(stat, hits);
+        Writetoredis(stat, alltime.oldwalltime, config);
+      }
+      Flusherrors();
+    }
+
+    // If we don't have the run type yet, use defaults and throw error
+    if(!configknown){
+      Configure(0);
+      alarm(30, "Stonehenge: No RHDR Record found!  Using default cuts!\n", 0);
+    }
+
+    // The stateless tests of the rest of the batch, once the configuration
+    // is known
+    if(i >= flagged){
+      FlagBatch(config, batch, i, batchn);
+      flagged = batchn;
+    }
+    const uint8_t flags = batch.flags[i];
+    if(flags & kFlasher){
+      count.flashern++;
+      stat.flasher++;
+    }
+
+    // Should we adjust the trigger threshold?
+    setthreshold(flags);
+
+    // Bursts are ended at the time of any event, once the rate has fallen
+    if(primary){
+      BurstCheck(b, config, alltime.longtime);
+      CheckWindows(alltime.longtime);
+    }
+    CountBurst(flags & kBurstCand);
+
+    // Burst Detection Here
+    // If the current event is over our burst nhit threshold (nhitbcut):
+    //   * First update the buffer by dropping events older than burstwindow
+    //   * Then add the new event to the buffer
+    //   * Count the event in the extra burst windows, which flag or write
+    //     their own bursts
+    //   * If we were not in a burst, check whether one has started
+    //   * If we were in a burst: write event to file, and check if the burst has ended
+
+    uint32_t reclen = hits.reclen;
+
+    if(primary && (flags & kBurstCand)){
+      UpdateBuf(alltime.longtime, config.burstwindow);
+      AddEvBuf(zrec, alltime.longtime, reclen*sizeof(uint32_t), b);
+      // The extra windows are counted first, while the event is certain
+      // to be in the buffer for their burst files
+      stat.windowbursts |= CountWindows(alltime.longtime);
+
+      // Write to burst file if necessary
+      // A comment here about the following bit of opaque code:
+      // Burstfile returns whether a burst is ongoing, but we want burstbool
+      // to remain true after the burst ends, until it is reset.  We therefore
+      // logical-OR the return value of Burstfile with the existing value of 
+      // stat.burstbool.
+      stat.burstbool = (stat.burstbool | Burstfile(b, config, alltime,
+                        outfilebase, clobber) );
+
+    } // End Burst Loop
+    // L2 Filter
+    if(l2filter(i)){
+      write = true;
+      passretrig = true;
+      stat.l2++;
+    }
+  } // End Loop for Event Records
+
+  // Write out all non-event records:
+  else{
+    if(primary)
+      AddHistory(zrec, alltime.longtime,
+                 (zrec->data_words + NZDAB_WORD_SIZE)*sizeof(uint32_t));
+    write = true;
+    stat.l2++;
+  }
+  if(config.ratetarget > 0){
+    ControlRate(write ? (zrec->data_words + NZDAB_WORD_SIZE)*sizeof(uint32_t)
+                      : 0, batch.event[i]);
+  }
+  if(write){
+    count.writtenn++;
+    count.writtenbytes += (zrec->data_words + NZDAB_WORD_SIZE)*sizeof(uint32_t);
+  }
+  count.recordn++;
+  stat.l1++;
+  return write;
+}
+
+// This function counts the bursts of the main burst window as the burst
+// buffer finds them, from the times of the burst candidates: a burst opens
+// when a candidate brings the count in the window over burstsize, and ends
+// at any event once the count has fallen below endrate.
+void L2Engine::CountBurst(const bool candidate){
+  if(!bursting && !candidate)
+    return;
+  const uint64_t window = config.burstwindow*50000000ULL;
+  while(!burstcands.empty() && burstcands.front() + window < alltime.longtime)
+    burstcands.pop_front();
+  if(candidate){
+    burstcands.push_back(alltime.longtime);
+    if(!bursting && burstcands.size() > (size_t) config.burstsize){
+      bursting = true;
+      count.burstn++;
+    }
+  }
+  if(bursting && burstcands.size() < (size_t) config.endrate)
+    bursting = false;
+}
+
+// This function counts the bytes written towards the output rate.  At the
+// end of each second of detector time, it raises the nhit offset by one if
+// the rate was over the target, or lowers it by one if the rate was under
+// nine tenths of the target, within the bounds set.  Only events move the
+// clock.
+void L2Engine::ControlRate(const uint32_t bytes, const bool event){
+  ratebytes += bytes;
+  if(!event)
+    return;
+  // Start again after the first event, or if the clocks were reset
+  if(!ratestarted || alltime.longtime < ratestart){
+    ratestarted = true;
+    ratestart = alltime.longtime;
+    ratebytes = 0;
+    return;
+  }
+  const uint64_t elapsed = alltime.longtime - ratestart;
+  if(elapsed < rateinterval)
+    return;
+
+  const double rate = ratebytes*50000000.0/elapsed;
+  ratestart = alltime.longtime;
+  ratebytes = 0;
+  int offset = nhitoffset;
+  if(rate > config.ratetarget && offset < config.maxoffset)
+    offset++;
+  else if(rate < 0.9*config.ratetarget && offset > 0)
+    offset--;
+  if(offset == nhitoffset)
+    return;
+
+  nhitoffset = offset;
+  adjustments++;
+  if(nhitoffset > maxoffsetused)
+    maxoffsetused = nhitoffset;
+  if(primary && yesredis)
+    Writeoffset(nhitoffset, rate, alltime.walltime);
+}
+
+// This function returns a fingerprint of an event, from its clocks, nhit and
+// length, by which an exact duplicate is told from another event given the
+// same GTID
+static uint64_t Fingerprint(const hitinfo & hit){
+  return (hit.time50 ^ (hit.time10 << 21))*31 +
+         ((uint64_t) hit.nhit << 32 | hit.reclen);
+}
+
+// This function counts the GTID of the current event as lost, late or
+// duplicated, and returns false if the event is an exact duplicate to be
+// dropped
+bool L2Engine::TrackGTID(){
+  uint64_t lost = 0;
+  const int seen = gtids.Add(hits.gtid, hits.run, Fingerprint(hits), lost);
+  count.gtidlost += lost;
+  stat.gtidlost += lost;
+  if(seen == kGTIDLate){
+    count.gtidlate++;
+    stat.gtidlate++;
+  }
+  else if(seen == kGTIDDuplicate || seen == kGTIDExact){
+    count.gtiddup++;
+    stat.gtiddup++;
+  }
+  if(seen == kGTIDExact && configknown && config.dropduplicates){
+    count.gtiddropped++;
+    return false;
+  }
+  return true;
+}
+
+// This function finishes the stream
+void L2Engine::Finish(){
+  count.gtidlost += gtids.Missing();
+  if(primary){
+    WindowsEndofFile();
+    if(ended)
+      Saveburstbuff();
+    else
+      BurstEndofFile(b, alltime.longtime);
+  }
+}
+
+// This function ends the subfile of the primary, closing any burst file,
+// but keeps the burst buffer, extra windows and GTIDs for the next
+void L2Engine::EndSubfile(){
+  if(primary)
+    BurstEndofSubfile(b, alltime.longtime);
+  ended = true;
+}
+
+// This function starts the next subfile with the clocks, thresholds,
+// retrigger state and burst state as they were.  The counts start again,
+// but the prescales keep their place.
+void L2Engine::NextSubfile(char* const infile, char* const outbase){
+  infilename = infile;
+  outfilebase = outbase;
+  if(primary){
+    NextBuf(outbase, clobber);
+    ClearHistory();
+  }
+  counts next = CountInit();
+  memcpy(next.prescalen, count.prescalen, sizeof(next.prescalen));
+  count = next;
+  cuts.Reset();
+  ended = false;
+}
+
+// This function prints some information at the end of the file
+void L2Engine::PrintClosing() const{
+  char messg[2048];
+  int len = snprintf(messg, sizeof(messg), "Stonehenge: Subfile %s finished."
+                     "  %lu records,  %lu events processed.\n"
+                     "%lu events pass no cut\n",
+                     outfilebase ? outfilebase : "",
+                     (unsigned long) count.recordn,
+                     (unsigned long) count.eventn,
+                     (unsigned long) cuts.Key(0));
+  if(len > 0 && (size_t) len < sizeof(messg))
+    len += snprintf(messg + len, sizeof(messg) - len, "GTIDs: %lu lost, %lu "
+                    "late, %lu duplicated, %lu exact duplicates dropped\n",
+                    (unsigned long) count.gtidlost,
+                    (unsigned long) count.gtidlate,
+                    (unsigned long) count.gtiddup,
+                    (unsigned long) count.gtiddropped);
+  if(!primary && len > 0 && (size_t) len < sizeof(messg))
+    len += snprintf(messg + len, sizeof(messg) - len, "%lu bursts would have "
+                    "opened\n", (unsigned long) count.burstn);
+  if(config.flashernhit > 0 && len > 0 && (size_t) len < sizeof(messg))
+    len += snprintf(messg + len, sizeof(messg) - len, "%lu events tagged as "
+                    "flashers\n", (unsigned long) count.flashern);
+  if(config.ratetarget > 0 && len > 0 && (size_t) len < sizeof(messg))
+    len += snprintf(messg + len, sizeof(messg) - len, "Rate control: nhit "
+                    "offset %d at the end, at most %d, after %d adjustments\n",
+                    nhitoffset, maxoffsetused, adjustments);
+  if(len > 0 && (size_t) len < sizeof(messg))
+    cuts.Summary(messg + len, sizeof(messg) - len);
+
+  alarm(21, messg, 0);
+  fprintf(stderr, "%s", messg);
+}
+
+// These functions write and read one plain value of the engine's state
+// This function says whether a checkpoint may be taken: the primary must
+// have no burst file open, in the burst buffer or any extra window
+bool L2Engine::CanCheckpoint() const{
+  return !primary || (b < 0 && !BurstOngoing() && !WindowsOngoing());
+}
+
+// These functions write or read a set of times and the information of an
+// event in a checkpoint
+static void TimeFields(ckptfile & c, alltimes & t){
+  Field(c, t.time10);
+  Field(c, t.time50);
+  Field(c, t.longtime);
+  Field(c, t.epoch);
+  Field(c, t.walltime);
+  Field(c, t.oldwalltime);
+  Field(c, t.exptime);
+}
+
+static void HitFields(ckptfile & c, hitinfo & h){
+  Field(c, h.time50);
+  Field(c, h.time10);
+  Field(c, h.triggertype);
+  Field(c, h.nhit);
+  Field(c, h.reclen);
+  Field(c, h.gtid);
+  Field(c, h.run);
+}
+
+// This function writes or reads the state of the engine which carries from
+// one record to the next in a checkpoint.  The configuration is not written,
+// only the run type it was chosen by.
+void L2Engine::CheckpointFields(ckptfile & c){
+  Field(c, configknown);
+  Field(c, configtype);
+  if(c.reading && c.ok && configknown){
+    SetConfig(configtype, allconfigs, config);
+    optionalcuts = OptionalCuts(config);
+  }
+  Field(c, NHITCUT);
+  Field(c, nhitoffset);
+  TimeFields(c, alltime);
+  Field(c, clockstarted);
+  TimeFields(c, standard);
+  Field(c, problem);
+  HitFields(c, hits);
+  gtids.CheckpointFields(c);
+  Field(c, passretrig);
+  Field(c, retrig);
+  Field(c, bursting);
+  Field(c, ratestarted);
+  Field(c, ratestart);
+  Field(c, ratebytes);
+  Field(c, maxoffsetused);
+  Field(c, adjustments);
+
+  Fields(c, count.prescalen, MAXPRESCALES+1);
+  Field(c, count.eventn);
+  Field(c, count.recordn);
+  Field(c, count.flashern);
+  Field(c, count.gtidlost);
+  Field(c, count.gtidlate);
+  Field(c, count.gtiddup);
+  Field(c, count.gtiddropped);
+  Field(c, count.writtenn);
+  Field(c, count.writtenbytes);
+  Field(c, count.burstn);
+  Fields(c, cuts.Keys(), L2Cuts::nkeys);
+
+  Field(c, stat.l1);
+  Field(c, stat.l2);
+  Field(c, stat.burstbool);
+  Field(c, stat.windowbursts);
+  Field(c, stat.orphan);
+  Field(c, stat.prescale);
+  Field(c, stat.charge);
+  Field(c, stat.flasher);
+  Field(c, stat.gtidlost);
+  Field(c, stat.gtidlate);
+  Field(c, stat.gtiddup);
+  Field(c, stat.gtid);
+  Field(c, stat.run);
+
+  uint64_t n = burstcands.size();
+  Field(c, n);
+  if(c.reading)
+    burstcands.clear();
+  for(uint64_t i=0; i<n && c.ok; i++){
+    uint64_t t = c.reading ? 0 : burstcands[i];
+    Field(c, t);
+    if(c.reading)
+      burstcands.push_back(t);
+  }
+
+  if(primary){
+    if(c.ok)
+      c.ok = c.reading ? ReadBufState(c.f) : WriteBufState(c.f);
+    WindowFields(c);
+  }
+}
@@ -0,0 +1,186 @@
+// L2 Engine Header
+//
+// K Labe, October 18 2026
+// K Labe, October 18 2026 - Keep the cut counters in the cut chain
+// K Labe, October 18 2026 - Add the prescale cut
+// K Labe, October 18 2026 - Process records in batches
+// K Labe, October 18 2026 - Count the in-time hits for the nhit cut
+// K Labe, October 18 2026 - Add the charge sum cut
+// K Labe, October 18 2026 - Add the output rate control
+// K Labe, October 18 2026 - Add the GTID tracker
+// K Labe, October 18 2026 - Count bursts in every engine, for what-if studies
+// K Labe, October 18 2026 - Add SetEpoch()
+// K Labe, October 18 2026 - Add EndSubfile() and NextSubfile()
+// K Labe, October 18 2026 - Add CheckpointFields() for checkpoints
+// K Labe, October 18 2026 - Try only the basic cuts when the rest are off
+
+// An L2Engine holds all the state of the level two filter for one stream of
+// records: the cut configurations, the clocks, the lowered threshold and
+// retrigger state, and the counters.  Records are given to ProcessRecord()
+// in order, and it decides which are written out.  Engines share nothing, so
+// several may run at once in one process, each on its own thread if need be.
+//
+// The burst buffer, extra burst windows, history ring, redis connection and
+// configuration log are services of the process, tied to files on disk, so
+// only one engine, the primary, may drive them.  The others only decide and
+// count.  Every engine counts the bursts its main burst window would open,
+// from the times of its burst candidates alone, so that engines with
+// different configurations may be compared.
+
+// The cuts applied by the engine, in the order of their bits in the counters.
+// The first L2BASICCUTS are always in use; the rest may be turned off by the
+// configuration, in which case only the first are tried.
+typedef CutChain<NhitCut, ExtTrigCut, RetrigCut, PrescaleCut,
+                 ChargeCut> L2Cuts;
+static const int L2BASICCUTS = 3;
+
+// The number of records decoded and tested together
+static const int L2BATCH = 256;
+
+// The events of a batch, with an array for each quantity, so that the tests
+// which depend only on the event can be made for several at once
+struct l2batch
+{
+const nZDAB* rec[L2BATCH];
+bool event[L2BATCH];      // Whether the record is an event
+uint16_t nhit[L2BATCH];
+uint32_t word[L2BATCH];   // Trigger word
+uint64_t time50[L2BATCH];
+uint64_t time10[L2BATCH];
+uint32_t gtid[L2BATCH];
+uint32_t run[L2BATCH];
+uint32_t reclen[L2BATCH];
+uint8_t flags[L2BATCH];   // Flags of the stateless tests (see cuts.h)
+uint16_t intime[L2BATCH]; // Hits within the TAC window, if there is one
+int charge[L2BATCH];      // Summed charge, if there is a charge cut
+};
+
+struct ckptfile;
+
+class L2Engine {
+public:
+  // The engine takes a copy of the configurations read from the
+  // configuration file, and chooses between them by run type.
+  L2Engine(const configuration allconfigs[2]);
+
+  // This function makes the engine the primary, which fills the header and
+  // burst buffers, detects bursts and writes statistics to redis if yesredis.
+  // Infilename and outfilebase are those of the subfile, and clobber tells
+  // whether burst files may be overwritten.
+  void SetPrimary(char* const infilename, char* const outfilebase,
+                  const bool clobber, const bool yesredis);
+
+  // This function names the subfile in the closing counts of an engine which
+  // is not the primary.
+  void SetName(char* const outbase) { outfilebase = outbase; }
+
+  // This function sets the epoch at which the clocks of an engine which is
+  // not the primary start, as the primary takes it from the burst buffer.
+  void SetEpoch(const int epoch) { alltime.epoch = epoch; }
+
+  // This function processes the record zrec, and returns whether it is to
+  // be written out.  The record is not modified.
+  bool ProcessRecord(nZDAB* const zrec);
+
+  // This function processes n records in order, and sets write[i] to whether
+  // record i is to be written out.  The answers are those of ProcessRecord()
+  // for each record in turn, but the events of up to L2BATCH records are
+  // decoded, and their stateless tests made, before any is decided.
+  void ProcessBatch(nZDAB* const recs[], const int n, bool write[]);
+
+  // This function finishes the stream at the end of the subfile, saving or
+  // closing any burst.
+  void Finish();
+
+  // These functions let the primary of a process which reads several
+  // subfiles in turn go on from one to the next without saving anything to
+  // disk.  EndSubfile() closes any burst file at the end of a subfile, and
+  // NextSubfile() starts the next, whose names are infilename and
+  // outfilebase, keeping all the state of the filter and burst buffer; only
+  // the counts start again.  Finish() is called once, at the end of the
+  // last.
+  void EndSubfile();
+  void NextSubfile(char* const infilename, char* const outfilebase);
+
+  // This function prints and logs the counts at the end of the subfile.
+  void PrintClosing() const;
+
+  // This function writes the state of the engine to a checkpoint, with that
+  // of the burst buffer and extra windows for the primary, or reads it back
+  // (see ckptio.h).  When reading, the engine should be set up as it was,
+  // with the same configuration file.  A checkpoint may only be taken
+  // between batches, when CanCheckpoint() says no burst file is open.
+  bool CanCheckpoint() const;
+  void CheckpointFields(ckptfile & c);
+
+  const counts & GetCounts() const { return count; }
+  const alltimes & GetTimes() const { return alltime; }
+  uint32_t GetRun() const { return hits.run; }  // Run of the latest event
+
+private:
+  void DecodeBatch(nZDAB* const recs[], const int n);
+  bool Step(nZDAB* const zrec, const int i);
+  void compute_times();
+  bool IsConsistent(alltimes & newat, const int dd);
+  bool TrackGTID();
+  void setthreshold(const uint8_t flags);
+  void CountBurst(const bool candidate);
+  bool l2filter(const int i);
+  void ControlRate(const uint32_t bytes, const bool event);
+  void WriteConfig();
+  void Configure(const uint32_t runtype);
+
+  // Configuration
+  configuration allconfigs[2];
+  configuration config;
+  bool configknown;    // Whether the configuration has been chosen
+  uint32_t configtype; // The run type it was chosen by
+  bool optionalcuts;   // Whether it turns on any cut after the basic ones
+  int NHITCUT;         // The current nhit cut, either the Hi or Lo one
+  int nhitoffset;      // Offset added to NHITCUT by the output rate control
+
+  // What the primary does, and its files
+  bool primary;
+  bool yesredis;
+  bool clobber;
+  char* infilename;
+  char* outfilebase;
+  int b;               // Burst file, as a stream of the burst writer
+  bool ended;          // Whether EndSubfile() was called for this subfile
+
+  // Clocks and the current event
+  alltimes alltime;
+  bool clockstarted;   // Whether the clocks have seen an event
+  alltimes standard;   // Previous unproblematic timestamp
+  bool problem;        // Was there a problem with the previous timestamp?
+  hitinfo hits;
+  GTIDTracker gtids;
+  l2batch batch;
+  int batchn;          // Records in the batch
+  int flagged;         // Events of the batch whose flags are worked out
+
+  // Flags for the retriggering logic:
+  // passretrig true means that if the next event is a retrigger, we should
+  // apply the special retrigger threshold.
+  // retrig true means that this event is a retrigger (defined in the sense
+  // 0 < dt < 460 ns ).
+  bool passretrig;
+  bool retrig;
+
+  // Times of the burst candidates within the burst window, and whether they
+  // make a burst, as counted by every engine
+  std::deque<uint64_t> burstcands;
+  bool bursting;
+
+  // Output rate control
+  bool ratestarted;
+  uint64_t ratestart;  // Start of the current measurement of the rate
+  uint64_t ratebytes;  // Bytes written since then
+  int maxoffsetused;
+  int adjustments;
+
+  // Counters
+  counts count;
+  L2Cuts cuts;
+  l2stats stat;
+};
@@ -7,8 +7,7 @@
 #include "ctype.h"
 
 // This function writes out the ZDAB record
-void OutZdab(nZDAB * const data, PZdabWriter * const zwrite,
-                    PZdabFile * const zfile){
+void OutZdab(nZDAB * const data, PZdabWriter * const zwrite){
   if(!data) return;
   const int index = PZdabWriter::GetIndex(data->bank_name);
   if(index < 0){
@@ -16,8 +15,7 @@ void OutZdab(nZDAB * const data, PZdabWriter * const zwrite,
      alarm(40, "Outzdab: unrecognized bank name.", 5);
   }
   else{
-    uint32_t * const bank = zfile->GetBank(data);
-    zwrite->WriteBank(bank, index);
+    zwrite->WriteExternal((uint32_t*) (data + 1), index, data->data_words);
   }
 }
 
@@ -46,14 +44,10 @@ void OutHeader(nZDAB* nzdab, PZdabWriter* const w){
       alarm(40, "Outheader: You never see this!", 6);
       exit(1);
     }
-    if(w->WriteBank(PZdabFile::GetBank(nzdab), index)){
+    if(w->WriteExternal((uint32_t*) (nzdab + 1), index, nzdab->data_words)){
       fprintf(stderr,"Error writing to zdab file\n");
       alarm(40, "Outheader: error writing to zdab file.", 7);
     }
-    // If bank is successfully written to file, unswap buffer for future use
-    else{
-      SWAP_INT32(nzdab+1, nzdab->data_words);
-    }
   }
 }
 
@@ -110,3 +104,16 @@ PZdabWriter * Output(const char * const base, bool clobber, bool burst){
   return ret;
 }
 
+// This function reopens an output file to resume writing it
+PZdabWriter* Reopen(const char * const base, const SZdabWriterState & state){
+  char outfilename[1024];
+  snprintf(outfilename, sizeof(outfilename), "/home/trigger/zdab/%s.zdab",
+           base);
+  PZdabWriter * const ret = new PZdabWriter(outfilename, 1, &state);
+  if(!ret || !ret->IsOpen()){
+    fprintf(stderr, "Could not reopen output file %s\n", outfilename);
+    alarm(40, "Output: Cannot reopen file.", 11);
+    exit(1);
+  }
+  return ret;
+}
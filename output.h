@@ -2,13 +2,14 @@
 //
 // K Labe, September 24 2014
 // K Labe, July 14      2015 - Move hexdump function to here
+// K Labe, October 18   2026 - Add Reopen function
 
 #include "PZdabWriter.h"
 #include "PZdabFile.h"
 
 // This function writes out to the file zwrite the ZDAB record pointed to 
-// by data in the file zfile.
-void OutZdab(nZDAB* const data, PZdabWriter* const zwrite, PZdabFile* const zfile);
+// by data.
+void OutZdab(nZDAB* const data, PZdabWriter* const zwrite);
 
 // This function prints ZDAB records to the screen in a human-readable format
 // ptr is the place to begin read the record, len is the number of characters
@@ -21,3 +22,8 @@ void OutHeader(nZDAB* nzdab, PZdabWriter* const w);
 // This function builds a new output file.  If it cannot open the file, it 
 // aborts the program, so the pointer does not need to be checked.
 PZdabWriter* Output(const char * const base, bool clobber, bool burst=0);
+
+// This function reopens the output file of the given base, cut back to the
+// point at which the writer's state was saved, to go on writing from there.
+// If it cannot, it aborts the program.
+PZdabWriter* Reopen(const char * const base, const SZdabWriterState & state);
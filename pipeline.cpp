@@ -0,0 +1,566 @@
+// Pipeline Code
+//
+// K Labe October 18 2026
+// K Labe October 18 2026   Hand the filter batches of records
+// K Labe October 18 2026   Add the reorder window
+// K Labe October 18 2026   Allow a pipeline without an output file
+// K Labe October 18 2026   Allow the pipeline to be started again
+
+// The reader copies each record into an arena, a ring of bytes, since the
+// input file reuses its buffer for every record.  The bytes of a record are
+// released once the output stage is done with it, and the reader waits for
+// room when the arena is full.  Each ring between stages has one producer
+// and one consumer, so it needs no lock: only the producer moves the tail,
+// and only the consumer the head.  A stage which finds its ring empty, or
+// the next one full, spins briefly, then yields, then sleeps; the time it
+// spends waiting is counted to give its utilization.  With one thread and
+// batches of more than one record, the filter reads the records into the
+// arena itself, since a batch must outlive the input buffer.
+//
+// The reorder window sits on the filter's side of the ring from the reader.
+// It is a heap of the events held, earliest first, from which the filter's
+// batches are taken.  Since the records then leave the arena out of order,
+// each carries the point up to which the arena may be released once it is
+// written: the start of the first record the filter still holds.
+
+#include "PZdabFile.h"
+#include "PZdabWriter.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <algorithm>
+#include "pipeline.h"
+#include "output.h"
+#include "curl.h"
+
+static const int RINGSLOTS = 4096;            // Records in each ring
+static const uint64_t ARENASIZE = 0x4000000;  // Bytes in the arena (64 MB)
+static const int READYSLOTS = MAXBATCH + MAXREORDER + 1;
+static const uint64_t maxtime = (1ULL << 43);  // Rollover of the 50 MHz clock
+
+// A record handed from one stage to the next
+struct stageitem
+{
+uint64_t seq;     // Sequence number, counting from 1, in the order read
+                  // before the filter and in the order passed on after it
+uint64_t start;   // Offset of the record in the arena, counting all bytes used
+uint64_t release; // Bytes of the arena which may be released once written
+uint64_t time50;  // 50 MHz time of an event, or 0 for other records
+uint32_t gtid;    // GTID of an event
+uint32_t len;     // Length of the record in bytes, or 0 at the end of the file
+bool write;       // Whether to write the record to the output file
+};
+
+// A ring between two stages.  Head and tail count the items ever taken and
+// added, and are kept apart so that the two threads do not share a cache line.
+struct stagering
+{
+stageitem item[RINGSLOTS];
+uint64_t head;
+char pad[64];
+uint64_t tail;
+};
+
+// Record of the work done by a stage
+struct stagetime
+{
+uint64_t waitns;   // Time spent waiting for the stage before or after
+uint64_t records;  // Records handled
+};
+
+enum stagename { kReader, kFilter, kOutput, NUMSTAGES };
+static const char* const stagenames[NUMSTAGES] =
+  { "reader", "filter", "output" };
+
+static int nthreads = 1;
+static PZdabFile* input = NULL;
+static PZdabWriter* output = NULL;
+static char* arena = NULL;
+static uint64_t used = 0;         // Bytes of the arena used by the reader
+static uint64_t released = 0;     // Bytes of the arena released after output
+static stagering tofilter, tooutput;
+static int batchsize = 1;
+static stageitem batch[MAXBATCH]; // Records held by the filter
+static int nbatch = 0;
+static nZDAB* currentrec = NULL;  // Record held with one thread and no batches
+static nZDAB* heldrec = NULL;     // Record read, but not yet in the arena
+static bool ended = false;        // Whether the filter has seen the end
+static stageitem enditem;         // The end of the file, for the output stage
+static bool endheld = false;      // Whether enditem is still to be passed on
+static uint64_t nextseq = 1;      // Sequence number expected by the filter
+static uint64_t readseq = 1;      // Sequence number of the next record read
+static uint64_t passseq = 1;      // Sequence number of the next record passed
+static uint64_t seenend = 0;      // End of the last record the filter has seen
+static stageitem ready[READYSLOTS]; // Records ready for the filter, in order
+static uint64_t readyhead = 0;
+static uint64_t readytail = 0;
+static int reorderevents = 0;     // Events held by the reorder window
+static int64_t reorderticks = 0;  // Longest an event is held, in 50 MHz ticks
+static stageitem heap[MAXREORDER+1]; // Events held, the earliest on top
+static int nheap = 0;
+static uint64_t newest = 0;       // Latest time of an event held
+static uint64_t heldfloor = ~0ULL; // No event held starts before this
+static uint64_t lastseq = 0;      // Latest sequence number taken from the heap
+static uint64_t reordered = 0;    // Events passed on after a later one
+static uint64_t jumps = 0;        // Times the window was emptied for a jump
+static stagetime stagetimes[NUMSTAGES];
+static uint64_t starttime = 0;
+static uint64_t stoptime = 0;
+static pthread_t reader;
+static pthread_t writer;
+
+// This function returns a monotonic time in nanoseconds
+static uint64_t Now(){
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+// This function waits a little, and longer the more often it has been called
+// in a row
+static void Backoff(unsigned & spins){
+  spins++;
+  if(spins < 64)
+    return;
+  if(spins < 1024)
+    sched_yield();
+  else{
+    timespec ts = {0, 50000};
+    nanosleep(&ts, NULL);
+  }
+}
+
+// This function adds an item to a ring, and returns false if it is full
+static bool Push(stagering & r, const stageitem & it){
+  const uint64_t tail = r.tail;
+  if(tail - __atomic_load_n(&r.head, __ATOMIC_ACQUIRE) == RINGSLOTS)
+    return false;
+  r.item[tail % RINGSLOTS] = it;
+  __atomic_store_n(&r.tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// This function takes an item from a ring, and returns false if it is empty
+static bool Pop(stagering & r, stageitem & it){
+  const uint64_t head = r.head;
+  if(__atomic_load_n(&r.tail, __ATOMIC_ACQUIRE) == head)
+    return false;
+  it = r.item[head % RINGSLOTS];
+  __atomic_store_n(&r.head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// This function adds an item to a ring, waiting for room
+static void PushWait(stagering & r, const stageitem & it, stagetime & t){
+  if(Push(r, it))
+    return;
+  const uint64_t t0 = Now();
+  unsigned spins = 0;
+  while(!Push(r, it))
+    Backoff(spins);
+  t.waitns += Now() - t0;
+}
+
+// This function takes an item from a ring, waiting for one
+static void PopWait(stagering & r, stageitem & it, stagetime & t){
+  if(Pop(r, it))
+    return;
+  const uint64_t t0 = Now();
+  unsigned spins = 0;
+  while(!Pop(r, it))
+    Backoff(spins);
+  t.waitns += Now() - t0;
+}
+
+// This function checks that an item is the one expected next
+static void CheckSequence(const stageitem & it, uint64_t & expected){
+  if(it.seq != expected){
+    fprintf(stderr, "Pipeline error: record %lu arrived when %lu was "
+            "expected\n", (unsigned long) it.seq, (unsigned long) expected);
+    alarm(40, "Stonehenge: Pipeline records out of order.", 12);
+    exit(1);
+  }
+  expected++;
+}
+
+// This function returns the space a record takes in the arena, which keeps
+// records aligned to 16 bytes
+static uint64_t Footprint(const uint32_t len){
+  return (len + 15) & ~(uint64_t) 15;
+}
+
+// This function finds the place of a record of len bytes in the arena, and
+// returns whether it is free.  A record is kept whole, so one which would
+// run past the end of the arena starts again at its beginning.
+static bool Place(const uint32_t len, uint64_t & start, uint64_t & end){
+  start = used;
+  if(start % ARENASIZE + Footprint(len) > ARENASIZE)
+    start += ARENASIZE - start % ARENASIZE;
+  end = start + Footprint(len);
+  return end - __atomic_load_n(&released, __ATOMIC_ACQUIRE) <= ARENASIZE;
+}
+
+// This function copies a record into the arena at the place found for it
+static void Copy(const nZDAB* const zrec, stageitem & it, const uint64_t start,
+                 const uint64_t end){
+  memcpy(arena + start % ARENASIZE, zrec, it.len);
+  it.start = start;
+  used = end;
+}
+
+// This function returns the length of a record in bytes
+static uint32_t Length(const nZDAB* const zrec){
+  return (zrec->data_words + NZDAB_WORD_SIZE)*sizeof(uint32_t);
+}
+
+// This function reads the 50 MHz time and GTID of an event for the reorder
+// window.  Other records are given a time of 0.
+// This method copied from PZdabFile
+static void ReadKey(const nZDAB* const zrec, stageitem & it){
+  if(!reorderevents || zrec->bank_name != ZDAB_RECORD)
+    return;
+  PmtEventRecord pmtEvent;
+  memcpy(&pmtEvent, zrec + 1, sizeof(pmtEvent));
+  SWAP_PMT_RECORD( &pmtEvent );
+  it.time50 = (uint64_t(pmtEvent.TriggerCardData.Bc50_2) << 11)
+                       + pmtEvent.TriggerCardData.Bc50_1;
+  it.gtid = pmtEvent.TriggerCardData.BcGT;
+}
+
+// This function returns the time from b to a in 50 MHz ticks, allowing for
+// the rollover of the clock
+static int64_t Ticks(const uint64_t a, const uint64_t b){
+  return int64_t((a - b + maxtime/2) % maxtime) - int64_t(maxtime/2);
+}
+
+// This function returns whether event a comes after event b, by time, then
+// by GTID, which rolls over at 2^24, then by the order they were read
+static bool Later(const stageitem & a, const stageitem & b){
+  if(a.time50 != b.time50)
+    return Ticks(a.time50, b.time50) > 0;
+  if(a.gtid != b.gtid)
+    return ((a.gtid - b.gtid) & 0xffffff) < 0x800000;
+  return a.seq > b.seq;
+}
+
+// This function makes the earliest event held ready for the filter
+static void Release(){
+  std::pop_heap(heap, heap + nheap, Later);
+  const stageitem & it = heap[--nheap];
+  if(it.seq < lastseq)
+    reordered++;
+  else
+    lastseq = it.seq;
+  ready[readytail++ % READYSLOTS] = it;
+  if(!nheap)
+    heldfloor = ~0ULL;
+}
+
+// This function empties the reorder window
+static void Flush(){
+  while(nheap)
+    Release();
+}
+
+// This function takes a record into the reorder window, and makes ready
+// those records which may go on to the filter
+static void Admit(const stageitem & it){
+  if(it.start + Footprint(it.len) > seenend)
+    seenend = it.start + Footprint(it.len);
+
+  // Records without a time keep their place among the events
+  if(!reorderevents || !it.time50){
+    Flush();
+    ready[readytail++ % READYSLOTS] = it;
+    return;
+  }
+
+  // An event from well before those held is a true discontinuity, which
+  // is left to the clock checks
+  if(nheap && Ticks(it.time50, newest) < -reorderticks){
+    jumps++;
+    Flush();
+  }
+  if(!nheap || Ticks(it.time50, newest) > 0)
+    newest = it.time50;
+  heap[nheap++] = it;
+  std::push_heap(heap, heap + nheap, Later);
+  if(it.start < heldfloor)
+    heldfloor = it.start;
+
+  while(nheap > reorderevents ||
+        (nheap && Ticks(newest, heap[0].time50) > reorderticks))
+    Release();
+
+  // Do not let the events held fill the arena, so that the reader may go on
+  if(nheap && seenend - heldfloor > ARENASIZE/2){
+    heldfloor = ~0ULL;
+    for(int i=0; i<nheap; i++)
+      heldfloor = std::min(heldfloor, heap[i].start);
+    if(seenend - heldfloor > ARENASIZE/2)
+      Flush();
+  }
+}
+
+// This function is the reader thread.  It copies each record into the arena
+// and hands it to the filter, ending with an item of zero length.
+static void* ReaderLoop(void*){
+  while(true){
+    stageitem it;
+    memset(&it, 0, sizeof(it));
+    it.seq = readseq++;
+    nZDAB* const zrec = input->NextRecord();
+    if(zrec){
+      it.len = Length(zrec);
+      uint64_t start, end;
+      if(!Place(it.len, start, end)){
+        const uint64_t t0 = Now();
+        unsigned spins = 0;
+        while(!Place(it.len, start, end))
+          Backoff(spins);
+        stagetimes[kReader].waitns += Now() - t0;
+      }
+      Copy(zrec, it, start, end);
+      ReadKey(zrec, it);
+      stagetimes[kReader].records++;
+    }
+    PushWait(tofilter, it, stagetimes[kReader]);
+    if(!zrec)
+      break;
+  }
+  return NULL;
+}
+
+// This function writes a record passed by the filter if it is to be written,
+// and releases the bytes of the arena no longer held
+static void Finish(const stageitem & it){
+  if(it.write && output)
+    OutZdab((nZDAB*) (arena + it.start % ARENASIZE), output);
+  if(it.release > released)
+    __atomic_store_n(&released, it.release, __ATOMIC_RELEASE);
+}
+
+// This function is the output thread.  It finishes each record in order
+// until the end of the file.
+static void* OutputLoop(void*){
+  uint64_t expected = 1;
+  while(true){
+    stageitem it;
+    PopWait(tooutput, it, stagetimes[kOutput]);
+    CheckSequence(it, expected);
+    if(!it.len)
+      break;
+    Finish(it);
+    stagetimes[kOutput].records++;
+  }
+  return NULL;
+}
+
+// This function forgets everything about the last file, so that the
+// pipeline may be started again for the next
+static void Reset(){
+  used = released = 0;
+  tofilter.head = tofilter.tail = 0;
+  tooutput.head = tooutput.tail = 0;
+  nbatch = 0;
+  currentrec = heldrec = NULL;
+  ended = endheld = false;
+  nextseq = readseq = passseq = 1;
+  seenend = 0;
+  readyhead = readytail = 0;
+  nheap = 0;
+  newest = 0;
+  heldfloor = ~0ULL;
+  lastseq = 0;
+  reordered = jumps = 0;
+  memset(stagetimes, 0, sizeof(stagetimes));
+  starttime = stoptime = 0;
+}
+
+// This function starts the pipeline
+void StartPipeline(PZdabFile* const zfile, PZdabWriter* const w,
+                   const int threads, const int batchrecords,
+                   const int reorder, const int reorderus){
+  Reset();
+  input = zfile;
+  output = w;
+  nthreads = threads < 1 ? 1 : (threads > NUMSTAGES ? NUMSTAGES : threads);
+  batchsize = batchrecords < 1 ? 1 :
+              (batchrecords > MAXBATCH ? MAXBATCH : batchrecords);
+  reorderevents = reorder < 0 ? 0 :
+                  (reorder > MAXREORDER ? MAXREORDER : reorder);
+  reorderticks = 50*(int64_t) (reorderus < 0 ? 0 : reorderus);
+  starttime = Now();
+  if(nthreads == 1 && batchsize == 1 && !reorderevents)
+    return;
+
+  arena = (char*) malloc(ARENASIZE);
+  if(arena == NULL ||
+     (nthreads > 1 && pthread_create(&reader, NULL, ReaderLoop, NULL)) ||
+     (nthreads > 2 && pthread_create(&writer, NULL, OutputLoop, NULL))){
+    printf("Error: Pipeline could not be started.\n");
+    alarm(40, "Stonehenge: Pipeline could not be started.", 12);
+    exit(1);
+  }
+}
+
+// This function reads up to a batch of records into the arena on the
+// filter's own thread.  A record which does not fit until the records before
+// are released is held in the input buffer for the next batch.
+static void ReadBatch(){
+  int n = 0;
+  while(n < batchsize && !ended){
+    nZDAB* const zrec = heldrec ? heldrec : input->NextRecord();
+    heldrec = NULL;
+    if(!zrec){
+      ended = true;
+      break;
+    }
+    stageitem it;
+    memset(&it, 0, sizeof(it));
+    it.len = Length(zrec);
+    uint64_t start, end;
+    if(!Place(it.len, start, end)){
+      if(!n && !nheap){
+        fprintf(stderr, "Pipeline error: a record of %u bytes does not fit "
+                "in the arena\n", it.len);
+        alarm(40, "Stonehenge: Record too large for the pipeline.", 12);
+        exit(1);
+      }
+      // The events held must be written to make room
+      if(!n)
+        Flush();
+      heldrec = zrec;
+      break;
+    }
+    it.seq = readseq++;
+    Copy(zrec, it, start, end);
+    ReadKey(zrec, it);
+    Admit(it);
+    n++;
+  }
+  stagetimes[kFilter].records += n;
+}
+
+// This function takes the records ready from the reader, up to a batch,
+// waiting for one
+static void TakeBatch(){
+  stageitem it;
+  PopWait(tofilter, it, stagetimes[kFilter]);
+  int n = 0;
+  do{
+    CheckSequence(it, nextseq);
+    if(!it.len){
+      ended = true;
+      enditem = it;
+      endheld = true;
+      break;
+    }
+    Admit(it);
+    stagetimes[kFilter].records++;
+  }while(++n < batchsize && Pop(tofilter, it));
+}
+
+// This function tells the output stage that the file has ended
+static void PassEnd(){
+  enditem.seq = passseq++;
+  if(nthreads > 2)
+    PushWait(tooutput, enditem, stagetimes[kFilter]);
+  endheld = false;
+}
+
+// This function returns the next batch of records for the filter
+int NextBatch(nZDAB* recs[]){
+  nbatch = 0;
+  if(nthreads == 1 && batchsize == 1 && !reorderevents){
+    recs[0] = currentrec = input->NextRecord();
+    return currentrec ? 1 : 0;
+  }
+
+  while(readyhead == readytail && !ended){
+    if(nthreads == 1)
+      ReadBatch();
+    else
+      TakeBatch();
+  }
+  if(ended)
+    Flush();
+  while(nbatch < batchsize && readyhead != readytail){
+    batch[nbatch] = ready[readyhead++ % READYSLOTS];
+    recs[nbatch] = (nZDAB*) (arena + batch[nbatch].start % ARENASIZE);
+    nbatch++;
+  }
+
+  // Tell the output stage that the file has ended, once the records before
+  // have been passed on
+  if(!nbatch && endheld)
+    PassEnd();
+  return nbatch;
+}
+
+// This function hands the current batch on to the output stage
+void PassBatch(const bool write[]){
+  if(nthreads == 1 && batchsize == 1 && !reorderevents){
+    if(currentrec && write[0] && output)
+      OutZdab(currentrec, output);
+    return;
+  }
+
+  // Each record releases the arena up to the first record still held
+  uint64_t floor = std::min(seenend, heldfloor);
+  for(uint64_t i=readyhead; i<readytail; i++)
+    floor = std::min(floor, ready[i % READYSLOTS].start);
+  for(int i=nbatch-1; i>=0; i--){
+    batch[i].release = floor;
+    floor = std::min(floor, batch[i].start);
+  }
+
+  for(int i=0; i<nbatch; i++){
+    batch[i].write = write[i];
+    batch[i].seq = passseq++;
+    if(nthreads > 2)
+      PushWait(tooutput, batch[i], stagetimes[kFilter]);
+    else
+      Finish(batch[i]);
+  }
+  nbatch = 0;
+}
+
+// This function stops the pipeline
+void StopPipeline(){
+  if(endheld)
+    PassEnd();
+  if(nthreads > 1)
+    pthread_join(reader, NULL);
+  if(nthreads > 2)
+    pthread_join(writer, NULL);
+  stoptime = Now();
+  free(arena);
+  arena = NULL;
+}
+
+// This function prints the utilization of each stage, and the events the
+// reorder window put back in order
+void PrintPipeline(){
+  if(reorderevents)
+    fprintf(stderr, "Stonehenge: %lu events put back in time order, reorder "
+            "window emptied %lu times for a jump in the clock\n",
+            (unsigned long) reordered, (unsigned long) jumps);
+  if(nthreads == 1 || stoptime <= starttime)
+    return;
+  const double elapsed = stoptime - starttime;
+  char messg[512];
+  int len = snprintf(messg, sizeof(messg), "Stonehenge: %d threads, "
+                     "stages busy:", nthreads);
+  for(int i=0; i<nthreads; i++){
+    len += snprintf(messg + len, sizeof(messg) - len, " %s %.1f%% (%lu "
+                    "records)", stagenames[i],
+                    100*(1 - stagetimes[i].waitns/elapsed),
+                    (unsigned long) stagetimes[i].records);
+  }
+  fprintf(stderr, "%s\n", messg);
+}
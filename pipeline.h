@@ -0,0 +1,62 @@
+// Pipeline Header
+//
+// K Labe, October 18 2026
+// K Labe, October 18 2026 - Hand the filter batches of records
+// K Labe, October 18 2026 - Add the reorder window
+// K Labe, October 18 2026 - The pipeline may be started again for another file
+
+// The main loop can be split into three stages on separate threads: a reader,
+// which takes records from the input file; the filter, which is the main
+// thread and makes every decision about a record; and an output stage, which
+// writes the records passed by the filter to the main output file.  Records
+// are handed from stage to stage through fixed rings without locks, each
+// carrying a sequence number, so the records are written in the order they
+// were read and every decision is taken as it is with a single thread.
+// With one thread, every stage runs in turn on the main thread.  The filter
+// takes the records in batches, so that it may work on several at once.
+//
+// Events may arrive a little out of time order.  A reorder window before the
+// filter holds up to a given number of events, for up to a given time, and
+// passes them on in order of their 50 MHz time and GTID, so that the clock
+// checks see them in order.  A record which is not an event, or a jump in
+// the clock larger than the window, empties the window first.  Records are
+// then written in the order they are passed on, rather than that they were
+// read.
+
+// The largest batch of records given to the filter
+#define MAXBATCH 1024
+
+// The most events the reorder window may hold
+#define MAXREORDER 1024
+
+// This function starts the pipeline with the given number of threads (one,
+// two for a separate reader, or three for a separate output stage too),
+// reading from zfile and writing to w, or writing nothing if w is NULL.  The
+// filter is given batches of up to
+// batchrecords records.  Up to reorderevents events are held for up to
+// reorderus microseconds to put them in order, or none if reorderevents is 0.
+// Once stopped, the pipeline may be started again for another file.
+void StartPipeline(PZdabFile* const zfile, PZdabWriter* const w,
+                   const int threads, const int batchrecords,
+                   const int reorderevents, const int reorderus);
+
+// This function puts the next batch of records for the filter in recs, and
+// returns their number, or 0 at the end of the file.  With a separate reader,
+// a batch holds those records already read, and so may be short.  The records
+// are valid until PassBatch() is called.
+int NextBatch(nZDAB* recs[]);
+
+// This function hands the current batch on to the output stage, which
+// writes record i to the output file if write[i] is true.  It must be called
+// once for each batch returned by NextBatch().
+void PassBatch(const bool write[]);
+
+// This function waits for the output stage to write every record passed to
+// it, and stops the threads.  It should be called before the output file is
+// closed.
+void StopPipeline();
+
+// This function prints the fraction of the time each stage was busy, rather
+// than waiting for the stage before or after it, and what the reorder window
+// did, for the file it was last started on.
+void PrintPipeline();
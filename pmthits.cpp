@@ -0,0 +1,324 @@
+// PMT Hits Code
+//
+// K Labe October 18 2026
+// K Labe October 18 2026   Add the charge sum and pedestal table
+// K Labe October 18 2026   Add the crate and card occupancy
+
+// The TACs of an event are counted in a histogram of fixed size on the stack,
+// and a window is slid along it.  Hits are counted in several histograms in
+// turn, so that hits falling in the same bin one after another do not wait
+// on each other; the histograms are added together with SSE2 where it is
+// available, as is the window slid along their running sum.
+//
+// The charge sum takes four hits at a time with SSE2: the words of the hits
+// are byte swapped and the charges and channels unpacked four at once, and
+// only the pedestals are looked up one by one.
+//
+// The occupancy is counted in a histogram of cards, one row of 32 crates for
+// each card slot, so that one shift and mask of the first word of a hit gives
+// its bin, and the crates are summed over the rows a vector at a time.
+
+#include "PZdabFile.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "pmthits.h"
+#include "curl.h"
+
+// Width of a bin of the TAC histogram, in TAC counts, and the number of bins
+static const int TACBINWIDTH = 16;
+static const int NTACBINS = 4096/TACBINWIDTH;
+
+// Number of histograms in which hits are counted in turn
+static const int NSUBHIST = 4;
+
+// Words of the PmtEventRecord, and of each hit
+static const int PMTWORDS = sizeof(PmtEventRecord)/sizeof(uint32_t);
+static const int HITWORDS = 3;
+
+// Pedestals of each charge type, by crate, card and channel.  The crate field
+// of a hit has 5 bits, so the table has room for 32 crates.
+static const int NCHANNELS = 32*16*32;
+static int16_t pedestal[3][NCHANNELS];
+
+// This function returns the TAC of a hit given the third word of its
+// FECReadoutData, in the external format of the record
+static inline uint32_t TAC(const uint32_t word){
+#ifdef SWAP_BYTES
+  // The TAC is in the two most significant bytes, which come first
+  return (((word & 0x0f) << 8) | ((word >> 8) & 0xff)) ^ 0x800;
+#else
+  return ((word >> 16) & 0xfff) ^ 0x800;
+#endif
+}
+
+// This function counts the hits in windows of the TAC histogram
+int InWindowHits(const nZDAB* const zrec, const int nhit, const int window){
+  // Only hits within the record are read
+  int n = nhit;
+  const int maxhit = ((int) zrec->data_words - PMTWORDS)/HITWORDS;
+  if(n > maxhit)
+    n = maxhit;
+  if(n <= 0)
+    return 0;
+
+  uint16_t hist[NSUBHIST][NTACBINS] __attribute__((aligned(16)));
+  memset(hist, 0, sizeof(hist));
+  const uint32_t* hit = (const uint32_t*) (zrec + 1) + PMTWORDS;
+  int i = 0;
+  for(; i + NSUBHIST <= n; i += NSUBHIST, hit += NSUBHIST*HITWORDS){
+    for(int j=0; j<NSUBHIST; j++)
+      hist[j][TAC(hit[j*HITWORDS + 2])/TACBINWIDTH]++;
+  }
+  for(; i < n; i++, hit += HITWORDS)
+    hist[0][TAC(hit[2])/TACBINWIDTH]++;
+
+  // Add the histograms together
+  int k = 0;
+#ifdef __SSE2__
+  for(; k + 8 <= NTACBINS; k += 8){
+    __m128i total = _mm_load_si128((const __m128i*) (hist[0] + k));
+    for(int j=1; j<NSUBHIST; j++)
+      total = _mm_add_epi16(total,
+                            _mm_load_si128((const __m128i*) (hist[j] + k)));
+    _mm_store_si128((__m128i*) (hist[0] + k), total);
+  }
+#endif
+  for(; k < NTACBINS; k++){
+    for(int j=1; j<NSUBHIST; j++)
+      hist[0][k] += hist[j][k];
+  }
+
+  // Running sum: sum[k] is the number of hits in the bins below k
+  uint16_t sum[NTACBINS + 1];
+  sum[0] = 0;
+  for(k=0; k<NTACBINS; k++)
+    sum[k+1] = sum[k] + hist[0][k];
+
+  int bins = (window + TACBINWIDTH - 1)/TACBINWIDTH;
+  if(bins < 1)
+    bins = 1;
+  if(bins > NTACBINS)
+    bins = NTACBINS;
+
+  // Largest number of hits in bins k to k+bins-1.  The sums are no more
+  // than MAX_NHIT, so they compare correctly as signed words.
+  int most = 0;
+  const int last = NTACBINS - bins;
+  k = 0;
+#ifdef __SSE2__
+  __m128i best = _mm_setzero_si128();
+  for(; k + 8 <= last + 1; k += 8){
+    const __m128i inwindow = _mm_sub_epi16(
+      _mm_loadu_si128((const __m128i*) (sum + k + bins)),
+      _mm_loadu_si128((const __m128i*) (sum + k)));
+    best = _mm_max_epi16(best, inwindow);
+  }
+  uint16_t lanes[8];
+  _mm_storeu_si128((__m128i*) lanes, best);
+  for(int j=0; j<8; j++)
+    if(lanes[j] > most)
+      most = lanes[j];
+#endif
+  for(; k <= last; k++)
+    if(sum[k + bins] - sum[k] > most)
+      most = sum[k + bins] - sum[k];
+  return most;
+}
+
+// This function reads the table of pedestals
+void ReadPedestals(const char* filename){
+  FILE* file = fopen(filename, "r");
+  if(file == NULL){
+    fprintf(stderr, "Could not open pedestal table %s\n", filename);
+    alarm(40, "Stonehenge could not open the pedestal table.  Aborting.", 12);
+    exit(1);
+  }
+  int crate, card, channel, qhs, qhl, qlx;
+  int n;
+  while((n = fscanf(file, "%d %d %d %d %d %d", &crate, &card, &channel,
+                    &qhs, &qhl, &qlx)) == 6){
+    if(crate < 0 || crate >= 32 || card < 0 || card >= 16 ||
+       channel < 0 || channel >= 32){
+      fprintf(stderr, "Pedestal table %s has a bad channel %d/%d/%d\n",
+              filename, crate, card, channel);
+      alarm(40, "Stonehenge: Bad pedestal table.  Aborting.", 12);
+      exit(1);
+    }
+    const int id = crate*512 + card*32 + channel;
+    pedestal[0][id] = qhs;
+    pedestal[1][id] = qhl;
+    pedestal[2][id] = qlx;
+  }
+  if(n != EOF){
+    fprintf(stderr, "Could not read pedestal table %s\n", filename);
+    alarm(40, "Stonehenge: Bad pedestal table.  Aborting.", 12);
+    exit(1);
+  }
+  fclose(file);
+}
+
+// This function returns the number of a channel, given the first word of a
+// hit in native format
+static inline int ChannelNumber(const uint32_t word){
+  return UNPK_CRATE_ID(&word)*512 + UNPK_BOARD_ID(&word)*32 +
+         UNPK_CHANNEL_ID(&word);
+}
+
+// This function returns the charge of a hit of the given type, given the
+// second and third words of the hit in native format
+static inline int Charge(const uint32_t word1, const uint32_t word2,
+                         const int type){
+  if(type == kQhs)
+    return ((word1 >> 16) & 0xfff) ^ 0x800;
+  if(type == kQhl)
+    return (word2 & 0xfff) ^ 0x800;
+  return (word1 & 0xfff) ^ 0x800;
+}
+
+#ifdef __SSE2__
+// This function byte swaps four words, if the record and machine differ
+static inline __m128i Swap(const __m128i x){
+#ifdef SWAP_BYTES
+  const __m128i byte = _mm_set1_epi32(0xff);
+  return _mm_or_si128(
+    _mm_or_si128(_mm_slli_epi32(x, 24),
+                 _mm_slli_epi32(_mm_and_si128(x, _mm_slli_epi32(byte, 8)), 8)),
+    _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 8), _mm_slli_epi32(byte, 8)),
+                 _mm_srli_epi32(x, 24)));
+#else
+  return x;
+#endif
+}
+#endif
+
+// This function sums the charges of an event
+int ChargeSum(const nZDAB* const zrec, const int nhit, const int type){
+  int n = nhit;
+  const int maxhit = ((int) zrec->data_words - PMTWORDS)/HITWORDS;
+  if(n > maxhit)
+    n = maxhit;
+  if(n <= 0 || type < kQhs || type > kQlx)
+    return 0;
+
+  const int16_t* const ped = pedestal[type - kQhs];
+  const uint32_t* hit = (const uint32_t*) (zrec + 1) + PMTWORDS;
+  int sum = 0;
+  int i = 0;
+#ifdef __SSE2__
+  // The charge is in the high or low half of its word; it is shifted to the
+  // low half, masked, and its sign bit flipped
+  const int wordn = type == kQhl ? 2 : 1;
+  const int shift = type == kQhs ? 16 : 0;
+  const __m128i mask = _mm_set1_epi32(0xfff);
+  const __m128i sign = _mm_set1_epi32(0x800);
+  __m128i total = _mm_setzero_si128();
+  for(; i + 4 <= n; i += 4, hit += 4*HITWORDS){
+    const __m128i ids = Swap(_mm_set_epi32(hit[3*HITWORDS], hit[2*HITWORDS],
+                                           hit[HITWORDS], hit[0]));
+    const __m128i words = Swap(_mm_set_epi32(hit[3*HITWORDS + wordn],
+                                             hit[2*HITWORDS + wordn],
+                                             hit[HITWORDS + wordn],
+                                             hit[wordn]));
+    const __m128i q = _mm_xor_si128(
+      _mm_and_si128(_mm_srl_epi32(words, _mm_cvtsi32_si128(shift)), mask), sign);
+    // Crate (bits 21-25), card (26-29) and channel (16-20) of each hit
+    const __m128i channel = _mm_and_si128(_mm_srli_epi32(ids, 16),
+                                          _mm_set1_epi32(0x1f));
+    const __m128i crate = _mm_and_si128(_mm_srli_epi32(ids, 21),
+                                        _mm_set1_epi32(0x1f));
+    const __m128i card = _mm_and_si128(_mm_srli_epi32(ids, 26),
+                                       _mm_set1_epi32(0xf));
+    int id[4] __attribute__((aligned(16)));
+    _mm_store_si128((__m128i*) id, _mm_or_si128(
+      _mm_or_si128(_mm_slli_epi32(crate, 9), _mm_slli_epi32(card, 5)), channel));
+    const __m128i peds = _mm_set_epi32(ped[id[3]], ped[id[2]], ped[id[1]],
+                                       ped[id[0]]);
+    total = _mm_add_epi32(total, _mm_sub_epi32(q, peds));
+  }
+  int lanes[4] __attribute__((aligned(16)));
+  _mm_store_si128((__m128i*) lanes, total);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+  for(; i < n; i++, hit += HITWORDS){
+    uint32_t words[HITWORDS];
+    memcpy(words, hit, sizeof(words));
+    SWAP_INT32(words, HITWORDS);
+    sum += Charge(words[1], words[2], type) - ped[ChannelNumber(words[0])];
+  }
+  return sum;
+}
+
+// This function returns the bin of a hit in the occupancy histogram, the
+// card number times 32 plus the crate number, given the first word of the
+// hit in the external format of the record
+static inline uint32_t CardBin(const uint32_t word){
+#ifdef SWAP_BYTES
+  // Card and crate are in bits 21-29, within the two bytes which come first
+  return ((((word & 0xff) << 8) | ((word >> 8) & 0xff)) >> 5) & 0x1ff;
+#else
+  return (word >> 21) & 0x1ff;
+#endif
+}
+
+// This function finds the busiest crate and card of an event
+void HotCrateCard(const nZDAB* const zrec, const int nhit, int & crate,
+                  int & card){
+  crate = card = 0;
+  int n = nhit;
+  const int maxhit = ((int) zrec->data_words - PMTWORDS)/HITWORDS;
+  if(n > maxhit)
+    n = maxhit;
+  if(n <= 0)
+    return;
+
+  uint16_t occupancy[16*32] __attribute__((aligned(16)));
+  memset(occupancy, 0, sizeof(occupancy));
+  const uint32_t* hit = (const uint32_t*) (zrec + 1) + PMTWORDS;
+  for(int i=0; i<n; i++, hit += HITWORDS)
+    occupancy[CardBin(hit[0])]++;
+
+  // The counts are no more than MAX_NHIT, so they compare correctly as
+  // signed words
+#ifdef __SSE2__
+  __m128i crates[4];
+  __m128i cards = _mm_setzero_si128();
+  for(int j=0; j<4; j++)
+    crates[j] = _mm_setzero_si128();
+  for(int slot=0; slot<16; slot++){
+    const uint16_t* const row16 = occupancy + 32*slot;
+    for(int j=0; j<4; j++){
+      const __m128i row = _mm_load_si128((const __m128i*) (row16 + 8*j));
+      crates[j] = _mm_add_epi16(crates[j], row);
+      cards = _mm_max_epi16(cards, row);
+    }
+  }
+  const __m128i hotcrate = _mm_max_epi16(_mm_max_epi16(crates[0], crates[1]),
+                                         _mm_max_epi16(crates[2], crates[3]));
+  uint16_t lanes[2][8] __attribute__((aligned(16)));
+  _mm_store_si128((__m128i*) lanes[0], hotcrate);
+  _mm_store_si128((__m128i*) lanes[1], cards);
+  for(int j=0; j<8; j++){
+    if(lanes[0][j] > crate)
+      crate = lanes[0][j];
+    if(lanes[1][j] > card)
+      card = lanes[1][j];
+  }
+#else
+  for(int c=0; c<32; c++){
+    int total = 0;
+    for(int slot=0; slot<16; slot++){
+      const uint16_t* const row = occupancy + 32*slot;
+      total += row[c];
+      if(row[c] > card)
+        card = row[c];
+    }
+    if(total > crate)
+      crate = total;
+  }
+#endif
+}
@@ -0,0 +1,33 @@
+// PMT Hits Header
+//
+// K Labe, October 18 2026
+// K Labe, October 18 2026 - Add the charge sum and pedestal table
+// K Labe, October 18 2026 - Add the crate and card occupancy
+
+// These functions look at the PMT hits of an event record, three words of
+// FECReadoutData for each hit following the PmtEventRecord.  The record is
+// left in its external format; only the words needed are unpacked.
+
+// This function returns the largest number of hits of the event zrec, of
+// nhit hits, whose TACs lie within window TAC counts of each other.  TACs
+// are binned in 16 counts, so the window is rounded up to a multiple of 16.
+int InWindowHits(const nZDAB* const zrec, const int nhit, const int window);
+
+// The charges which may be summed
+enum chargetype { kNoCharge, kQhs, kQhl, kQlx };
+
+// This function reads the table of pedestals, one line for each channel
+// giving its crate, card and channel numbers and its Qhs, Qhl and Qlx
+// pedestals, in ADC counts.  Channels not in the table have pedestals of 0.
+// It exits if the table cannot be read.
+void ReadPedestals(const char* filename);
+
+// This function returns the sum over the nhit hits of the event zrec of the
+// charge of the given type, less the pedestal of each channel.
+int ChargeSum(const nZDAB* const zrec, const int nhit, const int type);
+
+// This function finds the largest numbers of hits of the event zrec, of nhit
+// hits, in any one crate and in any one card, for tagging flashers and
+// electronic pickup.
+void HotCrateCard(const nZDAB* const zrec, const int nhit, int & crate,
+                  int & card);
@@ -1,6 +1,13 @@
 // Hiredis connector code
 //
 // K Labe September 23 2014
+// K Labe October 18 2026   Write the count of events kept by the prescale
+// K Labe October 18 2026   Write the count of events passing the charge cut
+// K Labe October 18 2026   Write the count of events tagged as flashers
+// K Labe October 18 2026   Add Writeoffset
+// K Labe October 18 2026   Write the counts of lost, late and duplicate GTIDs
+// K Labe October 18 2026   Write the optional counts only when configured,
+//                          and send them and the GTID counts in one go
 
 #include "hiredis.h"
 #include "redis.h"
@@ -13,13 +20,20 @@ void ResetStatistics(l2stats & stat){
   stat.l1 = 0;
   stat.l2 = 0;
   stat.burstbool = false;
+  stat.windowbursts = 0;
   stat.orphan = 0;
+  stat.prescale = 0;
+  stat.charge = 0;
+  stat.flasher = 0;
+  stat.gtidlost = 0;
+  stat.gtidlate = 0;
+  stat.gtiddup = 0;
   stat.gtid = 0;
   stat.run = 0;
 }
 
 // This function opens the redis connections
-void Openredis(l2stats & stat){
+void Openredis(){
   redis = redisConnect("192.168.80.128", 6379);
   if((redis)->err){
     printf("Error: %s\n", (redis)->errstr);
@@ -30,7 +44,6 @@ void Openredis(l2stats & stat){
     printf("Connected to Redis.\n");
     alarm(21, "Openredis: connected to server!", 0);
   }
-  ResetStatistics(stat);
 }
 
 // This function closes the redis connection
@@ -38,8 +51,24 @@ void Closeredis(){
   redisFree(redis);
 }
 
+// This function queues the commands to add n to the count key of the given
+// interval, without waiting for the replies, and counts them in queued.  It
+// returns false if they could not be queued.
+static bool AppendCount(const int interval, const int ts, const char* key,
+                        const int n, int & queued){
+  if(redisAppendCommand(redis, "INCRBY ts:%d:%d:%s %d", interval, ts, key,
+                        n) != REDIS_OK)
+    return false;
+  queued++;
+  if(redisAppendCommand(redis, "EXPIRE ts:%d:%d:%s %d", interval, ts, key,
+                        2400*interval) != REDIS_OK)
+    return false;
+  queued++;
+  return true;
+}
+
 // This function writes statistics to redis database
-void Writetoredis(l2stats & stat, const int time){
+void Writetoredis(l2stats & stat, const int time, const configuration & config){
   if(!redis){
     alarm(30, "Cannot connect to redis.", 0);
     return;
@@ -95,10 +124,69 @@ void Writetoredis(l2stats & stat, const int time){
       if(!reply)
         alarm(30, message, 0);
     }
+    for(int w=0; w < MAXWINDOWS; w++){
+      if(!(stat.windowbursts & (1 << w)))
+        continue;
+      reply = redisCommand(redis, "INCRBY ts:%d:id:%d:BURSTS%d 1", intervals[i], ts, w+1);
+      if(!reply)
+        alarm(30, message, 0);
+      reply = redisCommand(redis, "EXPIRE ts:%d:id:%d:BURSTS%d %d", intervals[i], ts, w+1, 2400*intervals[i]);
+      if(!reply)
+        alarm(30, message, 0);
+    }
+  }
+
+  // The counts of the optional cuts are only written when they are
+  // configured.  These and the GTID counts are sent for all the intervals at
+  // once, and their replies read together, to save round trips.
+  int queued = 0;
+  bool failed = false;
+  for(int i=0; i < NumInt; i++){
+    int ts = time/intervals[i];
+    if(config.prescale || config.nprescales)
+      failed |= !AppendCount(intervals[i], ts, "PRESCALE", stat.prescale, queued);
+    if(config.chargetype > 0)
+      failed |= !AppendCount(intervals[i], ts, "CHARGE", stat.charge, queued);
+    if(config.flashernhit > 0)
+      failed |= !AppendCount(intervals[i], ts, "FLASHERS", stat.flasher, queued);
+    failed |= !AppendCount(intervals[i], ts, "GTIDLOST", stat.gtidlost, queued);
+    failed |= !AppendCount(intervals[i], ts, "GTIDLATE", stat.gtidlate, queued);
+    failed |= !AppendCount(intervals[i], ts, "GTIDDUPS", stat.gtiddup, queued);
+  }
+  for(; queued > 0; queued--){
+    void* reply = NULL;
+    if(redisGetReply(redis, &reply) != REDIS_OK){
+      failed = true;
+      break;
+    }
+    freeReplyObject(reply);
   }
+  if(failed)
+    alarm(30, message, 0);
   ResetStatistics(stat);
 }
 
+// This function logs an adjustment of the nhit offset.  The current offset
+// is kept in l2:nhitoffset, and the latest adjustments, newest first, in the
+// list l2:nhitoffset:log as "time:offset:rate".
+void Writeoffset(const int offset, const double rate, const int time){
+  if(!redis){
+    alarm(30, "Cannot connect to redis.", 0);
+    return;
+  }
+  const char* message = "Writeoffset failed.";
+  void* reply = redisCommand(redis, "SET l2:nhitoffset %d", offset);
+  if(!reply)
+    alarm(30, message, 0);
+  reply = redisCommand(redis, "LPUSH l2:nhitoffset:log %d:%d:%.0f", time,
+                       offset, rate);
+  if(!reply)
+    alarm(30, message, 0);
+  reply = redisCommand(redis, "LTRIM l2:nhitoffset:log 0 9999");
+  if(!reply)
+    alarm(30, message, 0);
+}
+
 // This function retrieves the current gtid and run number for writing to redis
 void gtid(l2stats & stat, hitinfo hits){
   stat.gtid = hits.gtid; 
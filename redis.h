@@ -5,6 +5,15 @@
 // K Labe, November 10 2014  - Add gtid function
 // K Labe, February 4 2014 - change gtid function to accept a hitinfo object
 //                           instead of a PmtEventRecord object
+// K Labe, October 18 2026 - Add burst flags of the extra burst windows
+// K Labe, October 18 2026 - Openredis no longer resets the statistics, which
+//                           belong to the engine
+// K Labe, October 18 2026 - Add the count of events kept by the prescale
+// K Labe, October 18 2026 - Add the count of events passing the charge cut
+// K Labe, October 18 2026 - Add the count of events tagged as flashers
+// K Labe, October 18 2026 - Add Writeoffset to log the rate control
+// K Labe, October 18 2026 - Add the counts of lost, late and duplicate GTIDs
+// K Labe, October 18 2026 - Writetoredis takes the configuration
 
 #include <stdint.h>
 #include "Record_Info.h"
@@ -16,7 +25,14 @@ struct l2stats
 int l1;
 int l2;
 bool burstbool;
+uint32_t windowbursts; // Bitmask of extra burst windows which saw a burst
 int orphan;
+int prescale;         // Events kept by the prescale cut
+int charge;           // Events passing the charge sum cut
+int flasher;          // Events tagged as flashers
+int gtidlost;         // GTIDs which never arrived
+int gtidlate;         // Events which arrived after a later GTID
+int gtiddup;          // Events whose GTID was seen already
 uint32_t gtid;
 uint32_t run;
 };
@@ -26,14 +42,20 @@ uint32_t run;
 void ResetStatistics(l2stats & stat);
 
 // This function opens the redis connection.
-void Openredis(l2stats & stat);
+void Openredis();
 
 // This function closes the redis connection.
 void Closeredis();
 
 // This function writes the statistics contained in stat to the redis database,
-// timestamped with time, and then resets them.
-void Writetoredis(l2stats & stat, const int time);
+// timestamped with time, and then resets them.  The counts of the cuts and
+// tags which config turns off are not written.
+void Writetoredis(l2stats & stat, const int time, const configuration & config);
+
+// This function logs an adjustment of the nhit offset by the output rate
+// control to the new offset, made at time when the output rate was rate
+// bytes per second.
+void Writeoffset(const int offset, const double rate, const int time);
 
 // This function retrieves the current gtid and run for writing to redis
 void gtid(l2stats & stat, hitinfo hits);
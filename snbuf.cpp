@@ -4,6 +4,22 @@
 // K Labe September 26 2014 Add code to handle end of file and buffer saving
 // K Labe November 2 2014   Use a single contiguous block of memory for buffer
 // K Labe April 7 2016      Modify FillHeaderBuffer to check for run type
+// K Labe October 18 2026   Save only live events to a versioned binary state
+//                          file, and resume bursts across subfiles
+// K Labe October 18 2026   Replace the fixed ring with segments allocated up
+//                          to a memory budget, spilling to a scratch file
+// K Labe October 18 2026   Hand burst files to the writer thread as streams
+// K Labe October 18 2026   Fill burst files from the history ring if it is on
+// K Labe October 18 2026   Record each burst file in the burst catalog
+// K Labe October 18 2026   Add BurstCheck() to end bursts at any event
+// K Labe October 18 2026   Keep headers of every run-level bank type
+//                          pre-encoded for new burst files
+// K Labe October 18 2026   InitializeBuf may be called again for the next
+//                          subfile in the same process
+// K Labe October 18 2026   Add NextBuf() and BurstEndofSubfile() for a
+//                          process which keeps the buffers in memory
+// K Labe October 18 2026   Write and read the buffer state in checkpoints
+// K Labe October 18 2026   Save the extra burst windows with the buffer
 
 #include "PZdabFile.h"
 #include "PZdabWriter.h"
@@ -11,237 +27,725 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <deque>
 #include "struct.h"
+#include "ckptio.h"
 #include "snbuf.h"
+#include "snwin.h"
+#include "sncat.h"
+#include "snwrite.h"
+#include "snhist.h"
 #include "curl.h"
 #include "output.h"
 
 #define MAXSIZE 30472 // Largest possible event
-struct burststate
+
+// An event held in the burst buffer.  It lives either in a memory segment
+// (seg is the segment's sequence number) or, once spilled, in the scratch 
+// file, and off is its offset in bytes within that.
+struct bufev
 {
-int head;
-int tail;
-bool burst;
+uint64_t longtime;
+uint32_t reclen;
+bool spilled;
+uint64_t seg;
+uint64_t off;
+};
+
+// A block of memory into which consecutive events are packed.  The data is
+// a reference-counted block, so that it outlives the buffer while the burst
+// writer still has events from it queued.
+struct bufseg
+{
+char* data;
+uint32_t used; // Bytes filled
+int live;      // Number of events in the segment still in the buffer
 };
 
 static const uint64_t maxtime = (1UL << 43);
 static char* burstname;
 
 // Stuff for the burst buffer
-static const int EVENTNUM = 1000;        // Maximum Burst buffer depth
+// Events are packed into segments, which are allocated as the buffer grows 
+// and freed as it drains, up to a memory budget.  When the budget is reached
+// during a burst, the oldest segments are written sequentially to a scratch
+// file, and read back in order as the burst is written out.
 static const int ENDWINDOW = 1*50000000; // Integration window for ending bursts
-static char* burstev[EVENTNUM];      // Burst Event Buffer
-static uint64_t bursttime[EVENTNUM]; // Burst Time Buffer
-static burststate burstptr; // Object to hold pointers to head and tail of burst
+static const uint32_t SEGSIZE = 0x400000;        // Segment size (4 MB)
+static const uint64_t SPILLCHUNK = 0x4000000;    // Scratch file growth (64 MB)
+static const uint64_t SPILLMAX = 0x100000000ULL; // Scratch file limit (4 GB)
+static uint64_t budget = 128*0x100000ULL; // Memory budget of the buffer
+static std::deque<bufev> burstev;  // Burst Event Buffer, oldest first
+static std::deque<bufseg> segs;    // Segments in use, oldest first
+static uint64_t firstseg = 0;      // Sequence number of segs.front()
+static char* sparesegment = NULL;  // One free segment kept for reuse
+static size_t nspilled = 0;        // Number of events in the scratch file
+static int spillfd = -1;           // Scratch file descriptor
+static uint64_t spillhead = 0;     // Offset of the oldest spilled event
+static uint64_t spilltail = 0;     // Offset at which to spill next
+static uint64_t spillsize = 0;     // Space allocated to the scratch file
+static char* evbuf = NULL;         // Space to read back one spilled event
+static bool inburst = false;       // Whether a burst is ongoing
+static bool lastadded = false;     // Whether the latest event was buffered
 static uint64_t starttick = 0;   // Start time (in 50 MHz ticks) of burst
 static int burstindex = 0;  // Number of bursts seen
 static int bcount = 0;      // Number of events in present burst
+static char* burstbase = NULL;   // Output base used to name burst files
+static bool burstclobber = true; // Whether to overwrite burst files
+static int subfile = -1;         // Subfile number, for the burst catalog
+static sncatrec* part = NULL;    // Catalog record of the open burst file
+static int partbcount = 0;       // Value of bcount when it was opened
+static const char* fnburstspill = "burstspill.bin";
 
-// Stuff for the header buffer
-static const int headertypes = 3;
-static const uint32_t Headernames[headertypes] = 
-  { RHDR_RECORD, TRIG_RECORD, EPED_RECORD };
-static char* header[headertypes];
+// Stuff for the header buffer.  The latest record of each run-level bank type
+// is kept encoded as a ZEBRA logical record, ready to be copied into a new
+// file.  The version counts changes to the headers, and the block holding all
+// of them in the order of Headerbanks is rebuilt when it falls behind, so
+// that a new file gets its headers with a single copy.
+static const int headertypes = 6;
+static const int Headerbanks[headertypes] = 
+  { kRHDRindex, kTRIGindex, kEPEDindex, kSOSLindex, kCASTindex, kCAACindex };
+struct encodedheader
+{
+uint32_t* words;  // Encoded record, or NULL if none has been seen
+int nhead;        // Words before the bank data
+int nwords;       // Words in the record
+};
+static encodedheader header[headertypes];
+static uint32_t headerversion = 0;
+static uint32_t* headerblock = NULL;
+static int headerblockwords = 0;
+static uint32_t headerblockversion = 0;
 
-// These are the filenames for storing the buffer between subfiles
-static const char* fnburststate = "burststate.txt";
-static const char* fnburstev    = "burstev.bin";
-static const char* fnbursttime  = "bursttime.txt";
+// This is the file for storing the buffer between subfiles.  It is written
+// whole at the end of each subfile, under a temporary name, and renamed into
+// place, so that a crash while saving leaves the previous state intact.  It
+// is not kept up to date as events enter and leave the buffer: it holds only
+// the events of the last burst window, so a rewrite costs milliseconds, while
+// keeping it current would add a write to every event and need its own
+// compaction and journal to stay consistent.
+static const char* fnburststate    = "burststate.bin";
+static const char* fnburststatetmp = "burststate.bin.tmp";
 
-// This function initializes the two SN Buffers.  It tries to read in the 
-// state of the buffer from file, or otherwise initializes it empty.  It also 
-// initializes the header buffer.
-void InitializeBuf(){
-  // Try to read from file
-  FILE* fburststate = fopen(fnburststate, "r");
-  FILE* fburstev    = fopen(fnburstev,    "rb");
-  FILE* fbursttime  = fopen(fnbursttime,  "r");
-  if(fburststate && fburstev && fbursttime){
-    fscanf(fburststate, "%d %d %d", &burstptr.head, &burstptr.tail,
-                                    &burstptr.burst);
-    burstev[0] = (char*) malloc(MAXSIZE*sizeof(uint32_t)*EVENTNUM);
-    if(burstev[0] == NULL){
-      printf("Error: SN Buffer could not be initialized.\n");
-      alarm(40, "Stonehenge: SN Buffer could not be initialized.", 12);
-      exit(1);
-    }
-    for(int i=0; i<EVENTNUM; i++){
-      if(fscanf(fbursttime, "%llu \n", &bursttime[i]) != 1)
-        bursttime[i] = 0;
-      burstev[i] = (char*) (burstev[0] + i*MAXSIZE*sizeof(uint32_t));
-    }
-    double fburstevsize = ftell(fburstev);
-    if(fread(burstev[0], sizeof(char), sizeof(burstev), fburstev) != fburstevsize){
-      memset(burstev[0], 0, MAXSIZE*sizeof(uint32_t)*EVENTNUM);
-    }
-    // TODO: Handle the case of burst on file start correctly
-    // For now, just pretend we're not in the middle of a burst
-    if(burstptr.burst){
-      burstptr.burst = false;
-    }
+// Layout of the state file.  The header is followed, for each live event in
+// the buffer (oldest first), by a snstaterec and the record itself, padded
+// to a whole number of words, and then by the extra burst windows, as
+// written by WindowFields() (see snwin.h).  Bump the version if the layout
+// changes.
+static const char snstatemagic[4] = {'S', 'N', 'B', 'S'};
+static const uint32_t snstateversion = 2;
+struct snstatehdr
+{
+char magic[4];
+uint32_t version;
+uint32_t nevents;
+int32_t burst;
+int32_t burstindex;
+int32_t bcount;
+uint64_t starttick;
+uint64_t size;    // Size in bytes of the header and events
+};
+struct snstaterec
+{
+uint64_t longtime;
+uint32_t reclen;  // Length of the record in bytes
+uint32_t spare;
+};
+
+// This function returns the space taken by a record of reclen bytes in the
+// state file
+static uint64_t StateRecSize(const uint32_t reclen){
+  return sizeof(snstaterec) + ((reclen + 3) & ~3U);
+}
+
+// This function returns the data of an event in the buffer, reading it back
+// from the scratch file if it has been spilled
+static char* EvData(const bufev & ev){
+  if(!ev.spilled)
+    return segs[ev.seg - firstseg].data + ev.off;
+  if(pread(spillfd, evbuf, ev.reclen, ev.off) != (ssize_t) ev.reclen){
+    fprintf(stderr, "Could not read event back from burst scratch file\n");
+    alarm(30, "Stonehenge: could not read burst scratch file.", 0);
+    memset(evbuf, 0, ev.reclen);
+  }
+  return evbuf;
+}
+
+// This function queues an event in the buffer to be written to stream.
+// Spilled events are copied, since their place in the scratch file is reused.
+static void QueueBuffered(const int stream, const bufev & ev){
+  if(ev.spilled)
+    QueueCopy(stream, EvData(ev), ev.reclen);
+  else{
+    char* const data = segs[ev.seg - firstseg].data;
+    QueueEvent(stream, data, data + ev.off, ev.reclen);
+  }
+}
+
+// This function releases the memory of the oldest segment.  It is kept for
+// reuse if the writer is not still using it.
+static void FreeSeg(){
+  if(!sparesegment && BlockUnique(segs.front().data))
+    sparesegment = segs.front().data;
+  else
+    ReleaseBlock(segs.front().data);
+  segs.pop_front();
+  firstseg++;
+}
+
+// This function drops the oldest event from the buffer
+static void DropHead(){
+  const bufev & ev = burstev.front();
+  if(ev.spilled){
+    nspilled--;
+    spillhead = ev.off + ev.reclen;
+    if(!nspilled)
+      spillhead = spilltail = 0;
   }
-  // Otherwise, initialize empty
   else{
-    burstev[0] = (char*) malloc(MAXSIZE*sizeof(uint32_t)*EVENTNUM);
-    if(burstev[0] == NULL){
-      printf("Error: SN Buffer could not be initialized.\n");
-      alarm(40, "Stonehenge: SN Buffer could not be initialized.", 12);
+    bufseg & seg = segs[ev.seg - firstseg];
+    seg.live--;
+    // Segments empty in order, so this is the oldest.  Keep the newest one
+    // to fill, but start it over, unless the writer is still using it.
+    if(!seg.live){
+      if(segs.size() > 1 || !BlockUnique(seg.data))
+        FreeSeg();
+      else
+        seg.used = 0;
+    }
+  }
+  burstev.pop_front();
+}
+
+// This function empties the buffer
+static void EmptyBuf(){
+  while(!burstev.empty())
+    DropHead();
+}
+
+// This function makes sure the scratch file has room for size more bytes.
+// It returns false if it does not.
+static bool GrowSpill(const uint64_t size){
+  if(spillfd < 0){
+    spillfd = open(fnburstspill, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(spillfd < 0)
+      return false;
+  }
+  if(spilltail + size <= spillsize)
+    return true;
+  uint64_t newsize = spillsize;
+  while(newsize < spilltail + size)
+    newsize += SPILLCHUNK;
+  if(newsize > SPILLMAX ||
+     posix_fallocate(spillfd, spillsize, newsize - spillsize))
+    return false;
+  spillsize = newsize;
+  return true;
+}
+
+// This function writes the events of the oldest segment to the scratch file
+// and frees the segment.  It returns false if the scratch file is full.
+static bool SpillSeg(){
+  const size_t first = nspilled;
+  const bufseg & seg = segs.front();
+  const uint64_t start = burstev[first].off;
+  const uint64_t size = seg.used - start;
+  if(!GrowSpill(size) ||
+     pwrite(spillfd, seg.data + start, size, spilltail) != (ssize_t) size)
+    return false;
+  for(size_t i=first; i<burstev.size() && burstev[i].seg == firstseg; i++){
+    burstev[i].spilled = true;
+    burstev[i].off += spilltail - start;
+    nspilled++;
+  }
+  spilltail += size;
+  FreeSeg();
+  return true;
+}
+
+// This function frees the oldest segment to stay within the memory budget.
+// During a burst the segment is spilled to the scratch file, or if that is
+// full, the spilled events and then those of the segment go straight to the
+// burst file, which is reopened if a burst carried over from the last subfile
+// has none yet.  Otherwise, the burst threshold cannot be reached within the
+// budget, and the events are dropped.  While the buffer is being read back
+// from file (b is NULL) no burst file can be opened, and they are dropped
+// too.  It returns whether a segment was freed.
+static bool MakeRoom(int* const b){
+  if(inburst && SpillSeg())
+    return true;
+  fprintf(stderr, "ALARM: Burst Buffer has overflowed!\n");
+  alarm(30, "Stonehenge: Burst buffer has overflown.", 0);
+  if(!inburst){
+    fprintf(stderr, "ALARM: Burst Threshold larger than buffer!\n");
+    alarm(30, "Stonehenge: Burst threshold larger than buffer.", 0);
+  }
+  else if(b == NULL){
+    fprintf(stderr, "ALARM: Burst events dropped while reading the buffer!\n");
+    alarm(30, "Stonehenge: Burst events dropped while reading buffer.", 0);
+  }
+  else if(*b < 0)
+    Reopenburst(*b);
+  const uint64_t oldest = firstseg;
+  while(!burstev.empty() && firstseg == oldest &&
+        (burstev.front().spilled || burstev.front().seg == oldest)){
+    if(inburst && b != NULL)
+      AddEvBFile(*b);
+    else
+      DropHead();
+  }
+  return firstseg != oldest;
+}
+
+// This function copies an event into the newest segment, starting a new
+// segment if it does not fit.  The burst file b is passed on to MakeRoom().
+static void PushEvent(const char* const data, const uint64_t longtime,
+                      const uint32_t reclen, int* const b){
+  if(segs.empty() || segs.back().used + reclen > SEGSIZE){
+    while(segs.size() > 1 && (segs.size()+1)*SEGSIZE > budget)
+      if(!MakeRoom(b))
+        break;
+    bufseg seg;
+    seg.data = sparesegment ? sparesegment : AllocBlock(SEGSIZE);
+    sparesegment = NULL;
+    if(seg.data == NULL){
+      printf("Error: SN Buffer could not be extended.\n");
+      alarm(40, "Stonehenge: SN Buffer could not be extended.", 12);
       exit(1);
     }
-    for(int i=0; i<EVENTNUM; i++){
-      burstev[i] = (char*) (burstev[0] + i*MAXSIZE*sizeof(uint32_t));
-      bursttime[i]=0;
+    seg.used = 0;
+    seg.live = 0;
+    segs.push_back(seg);
+  }
+  bufseg & seg = segs.back();
+  bufev ev;
+  ev.longtime = longtime;
+  ev.reclen = reclen;
+  ev.spilled = false;
+  ev.seg = firstseg + segs.size() - 1;
+  ev.off = seg.used;
+  memcpy(seg.data + seg.used, data, reclen);
+  seg.used += (reclen + 3) & ~3U;
+  seg.live++;
+  burstev.push_back(ev);
+}
+
+// This function reads the buffer state saved by the previous subfile.
+// It returns false if there is no usable state file.
+static bool Loadburstbuff(){
+  int fd = open(fnburststate, O_RDONLY);
+  if(fd < 0)
+    return false;
+  struct stat st;
+  if(fstat(fd, &st) || (uint64_t) st.st_size < sizeof(snstatehdr)){
+    close(fd);
+    fprintf(stderr, "Burst state file is truncated.  Ignoring it.\n");
+    alarm(30, "Stonehenge: burst state file truncated.", 0);
+    return false;
+  }
+  char* map = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED){
+    fprintf(stderr, "Could not map burst state file.  Ignoring it.\n");
+    alarm(30, "Stonehenge: could not map burst state file.", 0);
+    return false;
+  }
+
+  const snstatehdr* hdr = (const snstatehdr*) map;
+  bool good = !memcmp(hdr->magic, snstatemagic, sizeof(snstatemagic)) &&
+              hdr->version == snstateversion &&
+              hdr->size <= (uint64_t) st.st_size;
+  // Check that each record fits before copying anything
+  uint64_t pos = sizeof(snstatehdr);
+  for(uint32_t i=0; good && i<hdr->nevents; i++){
+    const snstaterec* rec = (const snstaterec*) (map + pos);
+    if(pos + sizeof(snstaterec) > hdr->size ||
+       rec->reclen >= MAXSIZE*sizeof(uint32_t) ||
+       pos + StateRecSize(rec->reclen) > hdr->size)
+      good = false;
+    else
+      pos += StateRecSize(rec->reclen);
+  }
+  if(!good){
+    munmap(map, st.st_size);
+    fprintf(stderr, "Burst state file is unreadable or of an old version."
+                    "  Ignoring it.\n");
+    alarm(30, "Stonehenge: burst state file unreadable.", 0);
+    return false;
+  }
+
+  inburst = hdr->burst;
+  burstindex = hdr->burstindex;
+  bcount = hdr->bcount;
+  starttick = hdr->starttick;
+  pos = sizeof(snstatehdr);
+  for(uint32_t i=0; i<hdr->nevents; i++){
+    const snstaterec* rec = (const snstaterec*) (map + pos);
+    PushEvent(map + pos + sizeof(snstaterec), rec->longtime, rec->reclen,
+              NULL);
+    pos += StateRecSize(rec->reclen);
+  }
+  munmap(map, st.st_size);
+
+  // The windows follow the events
+  ckptfile c;
+  c.f = fopen(fnburststate, "rb");
+  c.reading = true;
+  c.ok = c.f != NULL && !fseek(c.f, pos, SEEK_SET);
+  WindowFields(c);
+  if(c.f)
+    fclose(c.f);
+  if(!c.ok){
+    fprintf(stderr, "Burst windows in the state file are unreadable.  "
+                    "Starting them afresh.\n");
+    alarm(30, "Stonehenge: burst windows in state file unreadable.", 0);
+  }
+  return true;
+}
+
+// This function writes the buffer state to the checkpoint file f, laid out
+// as in the state file, but written in order rather than through a mapping.
+bool WriteBufState(FILE* const f){
+  const int n = Burstlength();
+  snstatehdr hdr;
+  memcpy(hdr.magic, snstatemagic, sizeof(snstatemagic));
+  hdr.version = snstateversion;
+  hdr.nevents = n;
+  hdr.burst = inburst;
+  hdr.burstindex = burstindex;
+  hdr.bcount = bcount;
+  hdr.starttick = starttick;
+  hdr.size = sizeof(snstatehdr);
+  for(int i=0; i<n; i++)
+    hdr.size += StateRecSize(burstev[i].reclen);
+  if(fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+    return false;
+  static const char pad[4] = {0, 0, 0, 0};
+  for(int i=0; i<n; i++){
+    snstaterec rec;
+    rec.longtime = burstev[i].longtime;
+    rec.reclen = burstev[i].reclen;
+    rec.spare = 0;
+    const size_t padding = StateRecSize(rec.reclen) - sizeof(rec) -
+                           rec.reclen;
+    if(fwrite(&rec, sizeof(rec), 1, f) != 1 ||
+       fwrite(EvData(burstev[i]), rec.reclen, 1, f) != 1 ||
+       (padding && fwrite(pad, padding, 1, f) != 1))
+      return false;
+  }
+  return true;
+}
+
+// This function reads the buffer state written by WriteBufState()
+bool ReadBufState(FILE* const f){
+  snstatehdr hdr;
+  if(fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+     memcmp(hdr.magic, snstatemagic, sizeof(snstatemagic)) ||
+     hdr.version != snstateversion)
+    return false;
+  EmptyBuf();
+  inburst = hdr.burst;
+  burstindex = hdr.burstindex;
+  bcount = hdr.bcount;
+  starttick = hdr.starttick;
+  for(uint32_t i=0; i<hdr.nevents; i++){
+    snstaterec rec;
+    if(fread(&rec, sizeof(rec), 1, f) != 1 ||
+       rec.reclen >= MAXSIZE*sizeof(uint32_t) ||
+       fread(evbuf, StateRecSize(rec.reclen) - sizeof(rec), 1, f) != 1){
+      EmptyBuf();
+      inburst = false;
+      return false;
     }
-    burstptr.head = -1;
-    burstptr.tail = -1;
-    burstptr.burst = false;
+    PushEvent(evbuf, rec.longtime, rec.reclen, NULL);
+  }
+  return true;
+}
+
+// This function returns whether a burst is ongoing
+bool BurstOngoing(){
+  return inburst;
+}
+
+// This function sets the memory budget of the burst buffer, in MB.
+// At least two segments are always allowed.
+void setbudget(const int mb){
+  budget = mb*0x100000ULL;
+  if(budget < 2*SEGSIZE)
+    budget = 2*SEGSIZE;
+}
+
+// This function initializes the two SN Buffers.  It tries to read in the 
+// state of the buffer from file, or otherwise initializes it empty.  It also 
+// initializes the header buffer.
+void InitializeBuf(char* outfilebase, bool clobber){
+  burstbase = outfilebase;
+  burstclobber = clobber;
+
+  if(evbuf == NULL)
+    evbuf = (char*) malloc(MAXSIZE*sizeof(uint32_t));
+  if(evbuf == NULL){
+    printf("Error: SN Buffer could not be initialized.\n");
+    alarm(40, "Stonehenge: SN Buffer could not be initialized.", 12);
+    exit(1);
+  }
+
+  // Try to read from file, otherwise stay empty.  Anything left from an
+  // earlier subfile of this process was saved to the file.
+  EmptyBuf();
+  if(!Loadburstbuff()){
+    EmptyBuf();
+    inburst = false;
   }
 
   // Set up the header buffer
   for(int i=0; i<headertypes; i++){
-    header[i] = (char*) malloc(NWREC);
-    memset(header[i], 0, NWREC);
+    free(header[i].words);
+    header[i].words = NULL;
   }
+  headerversion++;
+}
 
-  // Close files if necessary
-  if(fburststate) fclose(fburststate);
-  if(fburstev)    fclose(fburstev);
-  if(fbursttime)  fclose(fbursttime);
+// This function goes on to the next subfile with the buffers as they are
+void NextBuf(char* outfilebase, bool clobber){
+  burstbase = outfilebase;
+  burstclobber = clobber;
 }
 
 // This function clears the pre-loaded buffer if the times are in the future
 void Checkbuffer(uint64_t firsttime){
-  if(!burstptr.head==-1){
-    uint64_t oldtime = bursttime[burstptr.head];
+  if(!burstev.empty()){
+    uint64_t oldtime = burstev.front().longtime;
     if( firsttime < oldtime ){
-      memset(burstev[0], 0, MAXSIZE*sizeof(uint32_t)*EVENTNUM);
-      for(int i=0; i<EVENTNUM; i++){
-        bursttime[i] = 0;
+      EmptyBuf();
+      // A burst carried over from the last subfile cannot be continued
+      if(inburst){
+        fprintf(stderr, "Burst %i cannot be continued in this subfile.\n",
+                burstindex);
+        alarm(30, "Stonehenge: cannot continue burst from last subfile.", 0);
+        inburst = false;
+        bcount = 0;
+        burstindex++;
       }
-      burstptr.head = -1;
-      burstptr.tail = -1;
     }
   }
 }
 
 // This function drops old events from the buffer once they expire
 void UpdateBuf(uint64_t longtime, int BurstLength){
-  // The case that the buffer is empty
-  if(burstptr.head==-1)
-    return;
-  // Normal Case
-  int BurstTicks = BurstLength*50000000; // length in ticks
-  while((bursttime[burstptr.head] < longtime - BurstTicks) && (burstptr.head!=-1)){
-    bursttime[burstptr.head] = 0;
-    memset(burstev[burstptr.head], 0, MAXSIZE*sizeof(uint32_t));
-    AdvanceHead();
-    // Reset to empty state if we have emptied the queue
-    if(burstptr.head==burstptr.tail){
-      burstptr.head=-1;
-      burstptr.tail=-1;
-    }
+  uint64_t BurstTicks = BurstLength*50000000ULL; // length in ticks
+  while(!burstev.empty() && burstev.front().longtime + BurstTicks < longtime){
+    DropHead();
+  }
+}
+
+// This function reads the run and GTID of an event in the buffer.  The
+// event is in external format.
+static void EvIds(const bufev & ev, uint32_t & run, uint32_t & gtid){
+  PmtEventRecord pmt;
+  memcpy(&pmt, EvData(ev) + sizeof(nZDAB), sizeof(pmt));
+  SWAP_PMT_RECORD(&pmt);
+  run = pmt.RunNumber;
+  gtid = pmt.TriggerCardData.BcGT;
+}
+
+// This function starts the catalog record of a burst file just opened.
+// Continued states whether the burst began in an earlier subfile.  The
+// oldest event in the buffer is the first to be written to the file.
+static void StartPart(const bool continued){
+  part = (sncatrec*) calloc(1, sizeof(sncatrec));
+  if(part == NULL){
+    printf("Error: Burst catalog record could not be allocated.\n");
+    alarm(40, "Stonehenge: Burst catalog record could not be allocated.", 12);
+    exit(1);
+  }
+  part->starttick = starttick;
+  part->subfile = subfile;
+  part->burst = burstindex;
+  part->flags = continued ? kCatContinued : 0;
+  partbcount = bcount;
+  if(!burstev.empty()){
+    EvIds(burstev.front(), part->run, part->firstgtid);
+    part->lastgtid = part->firstgtid;
+  }
+}
+
+// This function updates the peak rates of the burst
+static void NotePeaks(const configuration & config){
+  float rate = Burstlength()/(float) config.burstwindow;
+  if(rate > part->peakrate[0])
+    part->peakrate[0] = rate;
+  for(int i=0; i<NumWindows(); i++){
+    rate = WindowRate(i);
+    if(rate > part->peakrate[i+1])
+      part->peakrate[i+1] = rate;
   }
 }
 
-// This fuction adds events to an open Burst File
-void AddEvBFile(PZdabWriter* const b){
-  // Write out the data
-  if(b->WriteBank(
-        PZdabFile::GetBank((nZDAB*) burstev[burstptr.head]), kZDABindex)){
-    fprintf(stderr, "Error writing zdab to burst file\n");
-    alarm(30, "Stonehenge: Error writing zdab to burst file", 0);
+// This function finishes the catalog record of a burst file about to be
+// closed, and returns it to be handed to the writer.  Continues states 
+// whether the burst goes on in the next subfile.
+static sncatrec* EndPart(const uint64_t longtime, const bool continues){
+  sncatrec* const done = part;
+  done->endtick = longtime;
+  done->nevents = bcount - partbcount;
+  if(continues)
+    done->flags |= kCatContinues;
+  part = NULL;
+  return done;
+}
+
+// This fuction adds events to an open Burst File.  If the history ring is on,
+// the event has been streamed to the file already.
+void AddEvBFile(const int b){
+  // Queue the data for the writer
+  if(!HistoryOn())
+    QueueBuffered(b, burstev.front());
+  if(part){
+    uint32_t run;
+    EvIds(burstev.front(), run, part->lastgtid);
   }
   // Drop the data from the buffer
-  memset(burstev[burstptr.head], 0, MAXSIZE*sizeof(uint32_t));
-  bursttime[burstptr.head] = 0;
-  AdvanceHead();
+  DropHead();
   bcount++;
 }
 
 // This function adds a new event to the buffer
 void AddEvBuf(const nZDAB* const zrec, const uint64_t longtime, 
-              const uint32_t reclen, PZdabWriter* const b){
-  // Check whether we will overflow the buffer
-  // If so, first drop oldest event, then write
-  if(burstptr.head==burstptr.tail && burstptr.head!=-1){
-    fprintf(stderr, "ALARM: Burst Buffer has overflowed!\n");
-    alarm(30, "Stonehenge: Burst buffer has overflown.", 0);
-    if(!burstptr.burst){
-      fprintf(stderr, "ALARM: Burst Threshold larger than buffer!\n");
-      alarm(30, "Stonehenge: Burst threshold larger than buffer.", 0);
-    }
-    else
-      AddEvBFile(b);
-  }
-  
-  // Write the event to the buffer
-  // If buffer empty, set pointers appropriately
-  if(burstptr.tail==-1){
-    burstptr.tail=0;
-    burstptr.head=0;
-  }
-  if(reclen < MAXSIZE*4){
-    memcpy(burstev[burstptr.tail], zrec, reclen);
-  }
-  else{
+              const uint32_t reclen, int & b){
+  lastadded = false;
+  if(reclen >= MAXSIZE*4){
     char buf[128];
     sprintf(buf, "ALARM: Event too big for buffer!  %d bytes!"
                  "  Skipping this event.&notify\n", reclen);
     fprintf(stderr, buf);
     alarm(30, buf, 0);
+    return;
   }
-  bursttime[burstptr.tail] = longtime;
-  if(burstptr.tail<EVENTNUM - 1)
-    burstptr.tail++;
-  else
-    burstptr.tail=0;
+  PushEvent((const char*) zrec, longtime, reclen, &b);
+  lastadded = true;
 }
 
 // This function computes the number of burst candidate events currently
 // in the buffer
 int Burstlength(){
-  int burstlength = 0;
-  if(burstptr.head!=-1){
-    if(burstptr.head<burstptr.tail)
-      burstlength = burstptr.tail - burstptr.head;
-    else
-      burstlength = EVENTNUM + burstptr.tail - burstptr.head;
-  }
-  return burstlength;
+  return burstev.size();
 }
 
 // This function writes out the allowable portion of the buffer to a burst file
-void Writeburst(uint64_t longtime, PZdabWriter* b){
-  while((bursttime[burstptr.head] < longtime - ENDWINDOW) && (burstptr.head < burstptr.tail)){
+void Writeburst(uint64_t longtime, const int b){
+  while(!burstev.empty() && burstev.front().longtime + ENDWINDOW < longtime){
     AddEvBFile(b);
   }
 }
 
+// This function writes the buffered headers to the file w, which must not
+// yet be handed to the writer
+static void WriteHeaders(PZdabWriter* const w){
+  if(headerblockversion != headerversion){
+    headerblockwords = 0;
+    for(int i=0; i<headertypes; i++)
+      headerblockwords += header[i].words ? header[i].nwords : 0;
+    free(headerblock);
+    headerblock = (uint32_t*) malloc(headerblockwords*sizeof(uint32_t));
+    if(headerblock == NULL && headerblockwords){
+      printf("Error: Header buffer could not be allocated.\n");
+      alarm(40, "Stonehenge: Header buffer could not be allocated.", 12);
+      exit(1);
+    }
+    uint32_t* next = headerblock;
+    for(int i=0; i<headertypes; i++){
+      if(header[i].words){
+        memcpy(next, header[i].words, header[i].nwords*sizeof(uint32_t));
+        next += header[i].nwords;
+      }
+    }
+    headerblockversion = headerversion;
+  }
+  if(headerblockwords == 0 || !w->IsOpen())
+    return;
+
+  // The headers fit in the first block of a new file, but if not, they are
+  // written one at a time
+  if(w->WriteEncoded(headerblock, headerblockwords) == 1){
+    for(int i=0; i<headertypes; i++){
+      if(header[i].words)
+        w->WriteEncoded(header[i].words, header[i].nhead, header[i].nwords);
+    }
+  }
+}
+
+// This function opens a new file in the burst directory, named by suffix,
+// writes the buffered headers to it and hands it to the writer
+int NewBurstFile(const char* const suffix){
+  char namebuff[256];
+  snprintf(namebuff, 256, "%s_%s_%s", burstname, burstbase, suffix);
+  PZdabWriter* const w = Output(namebuff, burstclobber, 1);
+  WriteHeaders(w);
+  return OpenStream(w);
+}
+
+// This function queues the events in the buffer no older than since to the
+// stream b, leaving them in the buffer
+void CopyBuffer(const int b, const uint64_t since){
+  for(size_t i=0; i<burstev.size(); i++){
+    if(burstev[i].longtime >= since)
+      QueueBuffered(b, burstev[i]);
+  }
+}
+
+// This function queues the latest event to the stream b, if it was buffered
+void CopyNewest(const int b){
+  if(lastadded && !burstev.empty())
+    QueueBuffered(b, burstev.back());
+}
+
 // This function opens a new burst file
-void Openburst(PZdabWriter* & b, uint64_t longtime, char* outfilebase, 
+void Openburst(int & b, uint64_t longtime, char* outfilebase, 
                bool clobber){
-  starttick = bursttime[burstptr.head];
+  starttick = burstev.empty() ? longtime : burstev.front().longtime;
   char buff[128];
   sprintf(buff, "Burst %i has begun!\n", burstindex);
   fprintf(stderr, buff);
   alarm(20, buff, 0);
-  char namebuff[128];
-  sprintf(namebuff, "%s_%s_%i", burstname, outfilebase, burstindex);
-  b = Output(namebuff, clobber, 1);
-  for(int i=0; i<headertypes; i++){
-    OutHeader((nZDAB*) header[i], b);
-  }
+  burstbase = outfilebase;
+  burstclobber = clobber;
+  char suffix[16];
+  sprintf(suffix, "%i", burstindex);
+  b = NewBurstFile(suffix);
+  StartPart(false);
+  StreamHistory(b, starttick);
+}
+
+// This function opens a file to continue a burst carried over from the last
+// subfile.  The burst keeps its index, start time and event count.
+void Reopenburst(int & b){
+  char buff[128];
+  sprintf(buff, "Burst %i continues in subfile %s.\n", burstindex, burstbase);
+  fprintf(stderr, buff);
+  alarm(20, buff, 0);
+  char suffix[16];
+  sprintf(suffix, "%i", burstindex);
+  b = NewBurstFile(suffix);
+  StartPart(true);
+  // The whole of this subfile so far is part of the burst
+  StreamHistory(b, 0);
 }
 
 // This function writes out the remainder of the buffer when burst ends
-void Finishburst(PZdabWriter* & b, uint64_t longtime){
-  while(burstptr.head < burstptr.tail+1){
+void Finishburst(int & b, uint64_t longtime){
+  if(b < 0)
+    Reopenburst(b);
+  while(!burstev.empty()){
     AddEvBFile(b);
   }
-  burstptr.head = -1;
-  burstptr.tail = -1;
-  b->Close();
-  delete b;
+  StopHistory();
+  CloseStream(b, EndPart(longtime, false));
+  b = -1;
   uint64_t btime = longtime - starttick;
   float btimesec = btime/50000000.;
   char buff[256];
@@ -252,76 +756,158 @@ void Finishburst(PZdabWriter* & b, uint64_t longtime){
   burstindex++;
   // Reset to prepare for next burst
   bcount = 0;
-  burstptr.burst = false;
+  inburst = false;
+  // Give back the scratch space
+  if(spillfd >= 0 && spillsize){
+    ftruncate(spillfd, 0);
+    spillsize = 0;
+  }
 }
 
 // This function saves the buffer state to disk.
-// Burstev is saved in binary, bursttime and burststate are saved in ascii
+// Only the live events are written.  The file is filled through a mapping
+// of a temporary file, which then atomically replaces the old state.
 void Saveburstbuff(){
-  FILE* fburststate = fopen(fnburststate, "w");
-  FILE* fburstev = fopen(fnburstev, "wb");
-  FILE* fbursttime = fopen(fnbursttime, "w");
-  fwrite(burstev[0], sizeof(char), MAXSIZE*sizeof(uint32_t)*EVENTNUM, fburstev);
-  for(int i=0; i<EVENTNUM; i++){
-    fprintf(fbursttime, "%llu \n", bursttime[i]);
+  const int n = Burstlength();
+  uint64_t size = sizeof(snstatehdr);
+  for(int i=0; i<n; i++)
+    size += StateRecSize(burstev[i].reclen);
+
+  int fd = open(fnburststatetmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0 || ftruncate(fd, size)){
+    if(fd >= 0) close(fd);
+    fprintf(stderr, "Could not write burst state file.\n");
+    alarm(30, "Stonehenge: could not save burst buffer.", 0);
+    return;
+  }
+  char* map = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           fd, 0);
+  if(map == MAP_FAILED){
+    close(fd);
+    unlink(fnburststatetmp);
+    fprintf(stderr, "Could not map burst state file.\n");
+    alarm(30, "Stonehenge: could not save burst buffer.", 0);
+    return;
+  }
+
+  snstatehdr* hdr = (snstatehdr*) map;
+  memcpy(hdr->magic, snstatemagic, sizeof(snstatemagic));
+  hdr->version = snstateversion;
+  hdr->nevents = n;
+  hdr->burst = inburst;
+  hdr->burstindex = burstindex;
+  hdr->bcount = bcount;
+  hdr->starttick = starttick;
+  hdr->size = size;
+  uint64_t pos = sizeof(snstatehdr);
+  for(int i=0; i<n; i++){
+    snstaterec* rec = (snstaterec*) (map + pos);
+    rec->longtime = burstev[i].longtime;
+    rec->reclen = burstev[i].reclen;
+    rec->spare = 0;
+    memcpy(map + pos + sizeof(snstaterec), EvData(burstev[i]),
+           burstev[i].reclen);
+    pos += StateRecSize(burstev[i].reclen);
+  }
+
+  bool fail = msync(map, size, MS_SYNC);
+  munmap(map, size);
+  close(fd);
+
+  // The windows follow the events
+  ckptfile c;
+  c.f = fopen(fnburststatetmp, "ab");
+  c.reading = false;
+  c.ok = c.f != NULL;
+  WindowFields(c);
+  if(c.f){
+    c.ok = !fflush(c.f) && !fsync(fileno(c.f)) && c.ok;
+    fclose(c.f);
+  }
+  fail = fail || !c.ok;
+  if(fail || rename(fnburststatetmp, fnburststate)){
+    unlink(fnburststatetmp);
+    fprintf(stderr, "Could not write burst state file.\n");
+    alarm(30, "Stonehenge: could not save burst buffer.", 0);
   }
-  fprintf(fburststate, "%d %d %d", burstptr.head, burstptr.tail, burstptr.burst);
-  fclose(fburststate);
-  fclose(fburstev);
-  fclose(fbursttime);
 }
 
 // This function manages the writing of events into a burst file.
-bool Burstfile(PZdabWriter* & b, configuration config, alltimes alltime, 
+bool Burstfile(int & b, configuration config, alltimes alltime, 
                char* outfilebase, bool clobber){
+  // Reopen the burst file if the burst continues from the last subfile
+  if(inburst && b < 0)
+    Reopenburst(b);
+
   // Open a new burst file if a burst starts
-  if(!burstptr.burst){
+  if(!inburst){
     if(Burstlength() > config.burstsize){
       Openburst(b, alltime.longtime, outfilebase, clobber);
-      burstptr.burst = true;
+      inburst = true;
     }
   }
   
   // While in a burst
-  if(burstptr.burst){
+  if(inburst){
+    NotePeaks(config);
     Writeburst(alltime.longtime, b);
     // Check whether the burst has ended
     if(Burstlength() < config.endrate){
       Finishburst(b, alltime.longtime);
     }
   }
-  return burstptr.burst;
+  return inburst;
 }
 
-// This function wraps up the burst buffer when the end of file is reached
-void BurstEndofFile(PZdabWriter* & b, uint64_t longtime){
-  Saveburstbuff();
-  if(burstptr.burst)
+// This function drains and expires the buffer during a burst at the time of
+// every event, and ends the burst once the rate has fallen, so that the end
+// of a burst does not wait for the next burst candidate.  Draining comes
+// before expiring, so that no burst event expires unwritten.
+bool BurstCheck(int & b, const configuration & config, uint64_t longtime){
+  if(!inburst)
+    return false;
+  if(b < 0)
+    Reopenburst(b);
+  Writeburst(longtime, b);
+  UpdateBuf(longtime, config.burstwindow);
+  if(Burstlength() < config.endrate)
     Finishburst(b, longtime);
+  return inburst;
 }
 
-// This function advances the head pointer appropriately
-void AdvanceHead(){
-  if(burstptr.head < EVENTNUM - 1)
-    burstptr.head++;
-  else
-    burstptr.head = 0;
+// This function closes the burst file at the end of a subfile.  If a burst
+// is ongoing, the portion that can be written is flushed and the file
+// closed, and the rest of the burst is carried into the next subfile.
+void BurstEndofSubfile(int & b, uint64_t longtime){
+  if(inburst){
+    if(b < 0)
+      Reopenburst(b);
+    Writeburst(longtime, b);
+    StopHistory();
+    CloseStream(b, EndPart(longtime, true));
+    b = -1;
+    char buff[128];
+    sprintf(buff, "Burst %i continues past the end of subfile %s.\n",
+            burstindex, burstbase);
+    fprintf(stderr, buff);
+    alarm(20, buff, 0);
+  }
+}
+
+// This function wraps up the burst buffer when the end of file is reached,
+// and saves it for the next subfile
+void BurstEndofFile(int & b, uint64_t longtime){
+  BurstEndofSubfile(b, longtime);
+  Saveburstbuff();
 }
 
 // This function is used to reset the buffer if the events 
 // arrive out of order in a non-recoverable way.
-void ClearBuffer(PZdabWriter* & b, uint64_t longtime){
-  if(burstptr.burst)
+void ClearBuffer(int & b, uint64_t longtime){
+  if(inburst)
     Finishburst(b, longtime);
-  else{
-    memset(burstev[0], 0, MAXSIZE*sizeof(uint32_t)*EVENTNUM);
-    for(int i=0; i<EVENTNUM; i++){
-      bursttime[i] = 0;
-    }
-    burstptr.head = -1;
-    burstptr.tail = -1;
-    burstptr.burst = false;
-  }
+  else
+    EmptyBuf();
 }
 
 // This function checks whether the passed record is a header record, and,
@@ -329,32 +915,54 @@ void ClearBuffer(PZdabWriter* & b, uint64_t longtime){
 // It also checks the run type for RHDR records.  It returns 0 if the record
 // was not a RHDR, and the run type if it was.
 uint32_t FillHeaderBuffer(nZDAB* const zrec){
+  // Most records are events, which are passed over at once
+  if(zrec->bank_name == ZDAB_RECORD)
+    return 0;
+  const int index = PZdabWriter::GetIndex(zrec->bank_name);
+  int i = 0;
+  while(i < headertypes && Headerbanks[i] != index)
+    i++;
+  if(i == headertypes)
+    return 0;
+
+  // Encode the record from a copy padded to the size of its bank, in
+  // external format
+  const int nwords = PZdabWriter::GetBankNWords(index);
+  uint32_t data[NWREC];
+  memset(data, 0, nwords*sizeof(uint32_t));
+  memcpy(data, zrec + 1,
+         (zrec->data_words < (uint32_t) nwords ? zrec->data_words : nwords)*
+         sizeof(uint32_t));
+  header[i].words = (uint32_t*) realloc(header[i].words,
+                                        (nwords + NHEADMAX)*sizeof(uint32_t));
+  if(header[i].words == NULL){
+    printf("Error: Header buffer could not be allocated.\n");
+    alarm(40, "Stonehenge: Header buffer could not be allocated.", 12);
+    exit(1);
+  }
+  header[i].nwords = PZdabWriter::EncodeBank(data, index, nwords,
+                                             header[i].words, &header[i].nhead);
+  headerversion++;
+
+  // For RHDR's pull out run type to return
   uint32_t runtype = 0;
-  for(int i=0; i<headertypes; i++){
-    if(zrec->bank_name == Headernames[i]){
-      memset(header[i], 0, NWREC);
-      // Add 9 words for the length of the nZDAB header itself
-      // Copy the data to buffer in native format
-      uint32_t recLen = zrec->data_words+9;
-      memcpy(header[i], zrec, recLen*sizeof(uint32_t));
-      // For RHDR's pull out run type to return
-      if(i==0){
-        RunRecord* rhdr = (RunRecord*) (zrec+1);
-        SWAP_INT32(rhdr, 9);
-        runtype = rhdr->RunMask;
-        fprintf(stderr, "runtype: %d\n", runtype);
-        SWAP_INT32(rhdr, 9);
-      }
-    }
+  if(index == kRHDRindex){
+    RunRecord rhdr;
+    memcpy(&rhdr, data, sizeof(rhdr));
+    SWAP_INT32(&rhdr, 9);
+    runtype = rhdr.RunMask;
+    fprintf(stderr, "runtype: %d\n", runtype);
   }
   return runtype;
 }
 
-// This function returns the epoch value used to write timestamp
-// bursttime[burstptr.head]
+// This function returns the epoch value used to write the timestamp of the
+// oldest event in the buffer
 int GetEpoch()
 {
-  uint64_t time = bursttime[burstptr.head];
+  if(burstev.empty())
+    return 0;
+  uint64_t time = burstev.front().longtime;
   int epoch = time/maxtime;
   return epoch;
 }
@@ -363,3 +971,8 @@ int GetEpoch()
 void setburst(char* burstdir){
   burstname = burstdir;
 }
+
+// This function sets the subfile number
+void setsubfile(const int n){
+  subfile = n;
+}
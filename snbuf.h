@@ -10,11 +10,37 @@
 // K Labe, November 3 2014   - Add GetEpoch() function
 // K Labe, December 5 2014   - Add setburst() function
 // K Labe, April 7 2016      - Modify FillHeaderBuffer() to return run type
+// K Labe, October 18 2026   - Binary buffer state file; add Reopenburst()
+// K Labe, October 18 2026   - Elastic buffer; add setbudget(), drop AdvanceHead()
+// K Labe, October 18 2026   - Add NewBurstFile() and CopyBuffer() functions
+// K Labe, October 18 2026   - Burst files are streams of the writer thread;
+//                             add CopyNewest()
+// K Labe, October 18 2026   - Burst files stream the history ring if it is on
+// K Labe, October 18 2026   - Record burst files in the catalog; add setsubfile()
+// K Labe, October 18 2026   - Add BurstCheck() function
+// K Labe, October 18 2026   - Header buffer holds every run-level bank, encoded
+// K Labe, October 18 2026   - InitializeBuf may be called for each subfile
+// K Labe, October 18 2026   - Add NextBuf() and BurstEndofSubfile() functions
+// K Labe, October 18 2026   - Add WriteBufState(), ReadBufState() and
+//                             BurstOngoing() for checkpoints
+
+// Burst files are written on a separate thread (see snwrite.h).  The burst
+// file b passed to these functions is the writer's stream number, or -1 when
+// no burst file is open.
 
 // This function should be called once at the beginning of a subfile to set
 // up the burst buffers.  It tries to read in the buffer state from file, or
 // otherwise initializes empty.  It also initializes the header buffer.
-void InitializeBuf();
+// Outfilebase and clobber are used to name and open burst files.  It may be
+// called again for the next subfile, once the last was ended with
+// BurstEndofFile().
+void InitializeBuf(char* outfilebase, bool clobber);
+
+// This function may be called in place of InitializeBuf() for the next
+// subfile of a process which keeps the buffers in memory, once the last was
+// ended with BurstEndofSubfile().  Nothing is read from file, and the header
+// buffer keeps the headers seen so far.
+void NextBuf(char* outfilebase, bool clobber);
 
 // This function should be called after reading the first timestamp in a new
 // file to decide whether or not to throw out the loaded buffer data.
@@ -25,65 +51,107 @@ void Checkbuffer(uint64_t firsttime);
 // Events older than BurstLength (in secs) are expired.
 void UpdateBuf(uint64_t longtime, int BurstLength);
 
-// This function writes an event to an open Burst File b
-void AddEvBFile(PZdabWriter* const b);
+// This function queues the oldest event in the buffer to an open Burst File b
+// and drops it from the buffer.  If the history ring is on (see snhist.h), the
+// file is filled from the ring instead, and the event is only dropped.
+void AddEvBFile(const int b);
 
 // This function adds an event to the buffer
 // If the event is too large, a message is printed and the event does not 
 // enter the buffer.  (This should not occur).
-// The PZdabWriter object is required so that an event can be written to file
-// if a burst is ongoing and the buffer overflows.
+// The burst file b is required so that an event can be written to file
+// if a burst is ongoing, the buffer is at its memory budget and the scratch 
+// file is full.  It is reopened if the burst has no file yet.
 void AddEvBuf(const nZDAB* const zrec, const uint64_t longtime,
-              const uint32_t reclen, PZdabWriter* const b);
+              const uint32_t reclen, int & b);
 
 // This function returns the number of events in the buffer
 int Burstlength();
 
+// This function returns whether a burst is ongoing
+bool BurstOngoing();
+
+// These functions write the state of the buffer, as Saveburstbuff() does, to
+// the open checkpoint file f, and read it back in place of the present
+// state.  Each returns false if it could not.  ReadBufState() should be
+// called after InitializeBuf().
+bool WriteBufState(FILE* const f);
+bool ReadBufState(FILE* const f);
+
 // This function writers out the allowable portion of the buffer to a burst 
 // file b.  Longtime again specifies the current time (see comment elsewhere 
 // for definition).  By allowable, we mean that portion of the burst not
 // occuring within the integration period used to determine whether the burst 
 // has ended.
-void Writeburst(uint64_t longtime, PZdabWriter* b);
+void Writeburst(uint64_t longtime, const int b);
 
 // This function opens a new burst file b.  Longtime is the present time (see 
 // definition elsewhere).  Headertypes in the number of distinct kinds of header
 // records saved in the header buffer (header[]).  Clobber tells whether to
 // write over existing files.
-void Openburst(PZdabWriter* & b, uint64_t longtime, char* outfilebase,
+void Openburst(int & b, uint64_t longtime, char* outfilebase,
                bool clobber);
 
+// This function opens a new file in the burst directory, named after the 
+// burst naming string, the output base and suffix, with the headers written.
+// It returns the stream number of the file.
+int NewBurstFile(const char* const suffix);
+
+// This function queues the events in the buffer that are no older than 
+// since (in 50 MHz ticks) to the file b, without removing them.
+void CopyBuffer(const int b, const uint64_t since);
+
+// This function queues the event most recently passed to AddEvBuf to the
+// file b, if it entered the buffer.
+void CopyNewest(const int b);
+
+// This function opens a new burst file b to continue a burst which was 
+// ongoing at the end of the previous subfile.
+void Reopenburst(int & b);
+
 // This function writes out the remainder of the burst buffer when the burst
 // ends into the file b, and closes it.  Longtime is the present time (see 
 // definition elsewhere), which is used to provide some statistics about the
 // burst in the log.
-void Finishburst(PZdabWriter* & b, uint64_t longtime);
+void Finishburst(int & b, uint64_t longtime);
 
 // This function is used to save the state of the burstbuffer to disk so that
 // the burst detection algorithm can pick up from where it left off when the 
-// next file begins.
+// next file begins.  Only the events in the buffer are saved, together with 
+// the state of any ongoing burst and the extra burst windows (see snwin.h).
 void Saveburstbuff();
 
 // This function manages the writing of events into a burst file.  It returns
 // a bool stating whether a burst is ongoing.
-bool Burstfile(PZdabWriter* & b, configuration config, alltimes alltime, 
+bool Burstfile(int & b, configuration config, alltimes alltime, 
                char* outfilebase, bool clobber);
 
+// This function should be called at every event, with its time longtime (see
+// comment elsewhere for definition), once the configuration is known.  During
+// a burst, it writes out the allowable portion of the buffer, expires old
+// events and ends the burst if the rate has fallen below the end rate.  It
+// returns whether a burst is ongoing.
+bool BurstCheck(int & b, const configuration & config, uint64_t longtime);
+
 // This function wraps up the burst buffer when the end of a subfile is reached.
-void BurstEndofFile(PZdabWriter* & b, uint64_t longtime);
+// An ongoing burst has its file closed and is continued in the next subfile.
+// The state of the buffer is saved to disk for the next subfile.
+void BurstEndofFile(int & b, uint64_t longtime);
 
-// This function just advances the pointer to the head of the burst properly
-// when the buffer is updated.
-void AdvanceHead();
+// This function closes the burst file at the end of a subfile like
+// BurstEndofFile(), but saves nothing, for a process which goes on to the
+// next subfile itself.
+void BurstEndofSubfile(int & b, uint64_t longtime);
 
 // This function is used to clear the buffer when Stonehenge detects that 
 // the event timestamps have jumped in a non-recoverable way.  b and longtime 
 // are used in the event that a burst is ongoing when the buffer needs to be 
 // cleared.
-void ClearBuffer(PZdabWriter* & b, uint64_t longtime);
+void ClearBuffer(int & b, uint64_t longtime);
 
 // This function checks the zdab record zrec, and if it is one of the header-
-// type records, it records it in the header buffer.
+// type records (any run-level bank), it records it in the header buffer,
+// encoded ready to be written to new burst files.
 // If the record was a RHDR, it returns the run type; otherwise 0.
 uint32_t FillHeaderBuffer(nZDAB* const zrec);
 
@@ -92,3 +160,11 @@ uint32_t FillHeaderBuffer(nZDAB* const zrec);
 int GetEpoch();
 
 void setburst(char* burstdir);
+
+// This function sets the subfile number recorded in the burst catalog
+// (see sncat.h), or -1 if it is not known.
+void setsubfile(const int n);
+
+// This function sets the memory budget of the burst buffer in MB.  Beyond
+// it, a burst is spilled to a scratch file on local disk.
+void setbudget(const int mb);
@@ -0,0 +1,77 @@
+// Burst Catalog Code
+//
+// K Labe October 18 2026
+// K Labe October 18 2026   Add CutCatalog(), and lock the catalog to change it
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "struct.h"
+#include "sncat.h"
+
+// This function appends a record to the catalog.  Each record is added with
+// a single write to a file opened for appending, so a record is never split.
+// The catalog is locked meanwhile, so that it is not appended to while
+// CutCatalog() rewrites it.
+int AppendCatalog(const sncatrec & rec){
+  int fd = open(SNCATALOG, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if(fd < 0)
+    return -1;
+  struct stat st;
+  int fail = flock(fd, LOCK_EX) || fstat(fd, &st);
+  if(!fail && st.st_size == 0){
+    sncathdr hdr;
+    memcpy(hdr.magic, sncatmagic, sizeof(sncatmagic));
+    hdr.version = sncatversion;
+    hdr.recsize = sizeof(sncatrec);
+    hdr.spare = 0;
+    fail = write(fd, &hdr, sizeof(hdr)) != (ssize_t) sizeof(hdr);
+  }
+  if(!fail)
+    fail = write(fd, &rec, sizeof(rec)) != (ssize_t) sizeof(rec);
+  if(close(fd))
+    fail = 1;
+  return fail;
+}
+
+// This function removes the records of run and subfile from byte since
+// onward.  The records of other processes are moved up in their place.
+int CutCatalog(const uint64_t since, const long run, const int32_t subfile){
+  int fd = open(SNCATALOG, O_RDWR);
+  if(fd < 0)
+    return errno == ENOENT ? 0 : -1;
+  struct stat st;
+  if(flock(fd, LOCK_EX) || fstat(fd, &st)){
+    close(fd);
+    return -1;
+  }
+  const uint64_t start = since > sizeof(sncathdr) ? since : sizeof(sncathdr);
+  const uint64_t n = (uint64_t) st.st_size > start ?
+                     ((uint64_t) st.st_size - start)/sizeof(sncatrec) : 0;
+  if(!n){
+    close(fd);
+    return 0;
+  }
+  const size_t len = n*sizeof(sncatrec);
+  sncatrec* const recs = (sncatrec*) malloc(len);
+  int fail = recs == NULL || pread(fd, recs, len, start) != (ssize_t) len;
+  uint64_t kept = 0;
+  for(uint64_t i=0; !fail && i<n; i++){
+    if((run >= 0 && recs[i].run != run) || recs[i].subfile != subfile)
+      recs[kept++] = recs[i];
+  }
+  const size_t keptlen = kept*sizeof(sncatrec);
+  if(!fail && kept < n)
+    fail = pwrite(fd, recs, keptlen, start) != (ssize_t) keptlen ||
+           ftruncate(fd, start + keptlen);
+  free(recs);
+  if(close(fd))
+    fail = 1;
+  return fail;
+}
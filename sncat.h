@@ -0,0 +1,58 @@
+// Burst Catalog Header
+//
+// K Labe, October 18 2026
+// K Labe, October 18 2026 - Add CutCatalog()
+
+// The burst catalog is an append-only binary file in the burst directory
+// with one record for each burst file written.  A burst that runs across
+// subfiles has one record per subfile, with flags to link them.  Records are
+// appended as bursts end, so they are in order of run, and within a run of
+// start time, which lets burstcat find bursts by binary search.  The file
+// begins with a sncathdr; bump the version if the layout changes.
+
+#define SNCATALOG "/raid/data/burst/burstcatalog.bin"
+
+static const char sncatmagic[4] = {'S', 'N', 'B', 'C'};
+static const uint32_t sncatversion = 1;
+
+// Flags of a catalog record
+static const uint32_t kCatContinued = 1; // Burst began in an earlier subfile
+static const uint32_t kCatContinues = 2; // Burst goes on in the next subfile
+
+struct sncathdr
+{
+char magic[4];
+uint32_t version;
+uint32_t recsize;   // Size of each record in bytes
+uint32_t spare;
+};
+
+struct sncatrec
+{
+uint64_t starttick;  // Start of the burst, in 50 MHz ticks
+uint64_t endtick;    // End of the burst, or of this part of it
+uint64_t firstoffset;// Bytes written to the file before its first event
+uint64_t nbytes;     // Length of the file in bytes
+uint32_t run;
+int32_t subfile;     // Subfile number, or -1 if unknown
+int32_t burst;       // Burst index
+uint32_t flags;
+uint32_t firstgtid;  // GTID of the first and last burst candidates in
+uint32_t lastgtid;   // the file
+uint32_t nevents;    // Number of burst candidates in the file
+uint32_t spare;
+float peakrate[MAXWINDOWS+1]; // Peak rate (Hz) in the burst window, then
+                              // in each extra window
+uint32_t spare2[3];
+char path[144];      // Full path of the burst file
+};
+
+// This function appends rec to the catalog file, creating it if need be.
+// It returns 0 on success.
+int AppendCatalog(const sncatrec & rec);
+
+// This function removes from the catalog file the records of the given run
+// (or of any run, if run is negative) and subfile which begin at byte since
+// or later, keeping those appended meanwhile by other processes.  It
+// returns 0 on success.
+int CutCatalog(const uint64_t since, const long run, const int32_t subfile);
@@ -0,0 +1,134 @@
+// Burst History Code
+//
+// K Labe October 18 2026
+// K Labe October 18 2026   Add ClearHistory()
+
+// Records are packed into blocks of HISTSEG bytes, shared with the burst
+// writer, so streaming a record to a burst file copies nothing.  When the
+// budget is reached, the oldest block is dropped with all its records.  The
+// records are indexed by time in arrival order, which is time order but for
+// the rare event out of order, so the start of the pre-trigger window is
+// found by a binary search.
+
+#include "PZdabFile.h"
+#include "PZdabWriter.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <algorithm>
+#include "snhist.h"
+#include "snwrite.h"
+#include "curl.h"
+
+static const uint32_t HISTSEG = 0x400000; // Block size (4 MB)
+
+// A record in the ring
+struct histrec
+{
+uint64_t longtime;
+uint32_t reclen;
+char* block;       // Block holding the record
+const char* rec;
+};
+
+static std::deque<histrec> history;  // Records, oldest first
+static std::deque<char*> blocks;     // Blocks in use, oldest first
+static uint32_t used = 0;            // Bytes filled in the newest block
+static size_t maxblocks = 0;         // Blocks allowed by the budget
+static uint64_t pretrigger = 0;      // Pre-trigger window in 50 MHz ticks
+static bool dropped = false;         // Whether any block has been dropped
+static int stream = -1;              // Burst file streamed to, or -1
+
+// This function compares records by time for the binary search
+static bool Earlier(const histrec & rec, const uint64_t longtime){
+  return rec.longtime < longtime;
+}
+
+// This function drops the oldest block and its records
+static void DropBlock(){
+  char* const oldest = blocks.front();
+  while(!history.empty() && history.front().block == oldest)
+    history.pop_front();
+  ReleaseBlock(oldest);
+  blocks.pop_front();
+  dropped = true;
+}
+
+// This function sets up the history ring
+void InitializeHistory(const int budgetmb, const int pretriggerms){
+  pretrigger = pretriggerms*50000ULL;
+  maxblocks = budgetmb*0x100000ULL/HISTSEG;
+  if(maxblocks < 2)
+    maxblocks = 2;
+}
+
+// This function returns whether the history ring is in use
+bool HistoryOn(){
+  return pretrigger > 0;
+}
+
+// This function adds a record to the ring
+void AddHistory(const nZDAB* const zrec, const uint64_t longtime,
+                const uint32_t reclen){
+  // The run header is always written at the start of burst files
+  if(!pretrigger || reclen > HISTSEG || zrec->bank_name == RHDR_RECORD)
+    return;
+  if(blocks.empty() || used + reclen > HISTSEG){
+    if(blocks.size() == maxblocks)
+      DropBlock();
+    char* const block = AllocBlock(HISTSEG);
+    if(block == NULL){
+      printf("Error: History ring could not be extended.\n");
+      alarm(40, "Stonehenge: History ring could not be extended.", 12);
+      exit(1);
+    }
+    blocks.push_back(block);
+    used = 0;
+  }
+  histrec rec;
+  rec.longtime = longtime;
+  rec.reclen = reclen;
+  rec.block = blocks.back();
+  rec.rec = rec.block + used;
+  memcpy(rec.block + used, zrec, reclen);
+  used += (reclen + 3) & ~3U;
+  history.push_back(rec);
+  if(stream >= 0)
+    QueueEvent(stream, rec.block, rec.rec, rec.reclen);
+}
+
+// This function dumps the pre-trigger window and starts streaming
+void StreamHistory(const int b, const uint64_t start){
+  if(!pretrigger)
+    return;
+  const uint64_t since = start > pretrigger ? start - pretrigger : 0;
+  std::deque<histrec>::iterator it = std::lower_bound(history.begin(),
+                                       history.end(), since, Earlier);
+  if(dropped && it == history.begin() && !history.empty() &&
+     history.front().longtime > since){
+    const uint64_t held = start > history.front().longtime ?
+                          start - history.front().longtime : 0;
+    fprintf(stderr, "History ring holds only %.2f s of the pre-trigger "
+            "window.\n", held/50000000.);
+    alarm(30, "Stonehenge: History ring shorter than pre-trigger window.", 0);
+  }
+  for(; it != history.end(); ++it)
+    QueueEvent(b, it->block, it->rec, it->reclen);
+  stream = b;
+}
+
+// This function stops streaming
+void StopHistory(){
+  stream = -1;
+}
+
+// This function empties the ring
+void ClearHistory(){
+  while(!blocks.empty())
+    DropBlock();
+  used = 0;
+  dropped = false;
+  stream = -1;
+}
@@ -0,0 +1,39 @@
+// Burst History Header
+//
+// K Labe, October 18 2026
+// K Labe, October 18 2026 - Add ClearHistory()
+
+// The history ring keeps every record of the subfile, not only the burst
+// candidates, for as long as its memory budget allows.  When a burst begins,
+// the records of a pre-trigger window before its start are written to the
+// burst file from the ring, and every record after that is streamed to the
+// file until the burst ends.  The ring is off unless a pre-trigger window
+// is set.
+
+// This function sets up the history ring with a budget of budgetmb MB and a
+// pre-trigger window of pretriggerms milliseconds.  A window of zero turns
+// the ring off.
+void InitializeHistory(const int budgetmb, const int pretriggerms);
+
+// This function returns whether the history ring is in use, in which case
+// burst files are filled from it rather than from the burst buffer.
+bool HistoryOn();
+
+// This function adds the record zrec, of reclen bytes, to the ring at time
+// longtime (see comment elsewhere for definition).  Records without a time of
+// their own should be given the time of the last event.  If a burst file is
+// being streamed, the record is also queued to it.
+void AddHistory(const nZDAB* const zrec, const uint64_t longtime,
+                const uint32_t reclen);
+
+// This function queues to the burst file b the records in the ring from the
+// pre-trigger window before time start on, and then streams each new record
+// to b.  A start of zero queues the whole ring.
+void StreamHistory(const int b, const uint64_t start);
+
+// This function stops streaming records to the burst file.
+void StopHistory();
+
+// This function empties the ring, as at the start of the process, for the
+// next subfile.
+void ClearHistory();
@@ -0,0 +1,316 @@
+// Burst Window Code
+//
+// K Labe October 18 2026
+// K Labe October 18 2026   Queue window bursts to the writer thread
+// K Labe October 18 2026   Add NumWindows() and WindowRate()
+// K Labe October 18 2026   Add CheckWindows() to end bursts at any event
+// K Labe October 18 2026   Write and read the counters in checkpoints
+// K Labe October 18 2026   Carry the counters and bursts across subfiles
+
+// Each extra burst window counts the burst candidate events over its own
+// integration time.  Rather than keeping a list of events per window, detector
+// time is divided into bins of BINTICKS, and a ring holds the running total of
+// events at the start of each bin.  The count in any window is then the 
+// present total less the total at the start of its oldest bin, so that each
+// event costs the same however many windows there are.
+
+#include "PZdabFile.h"
+#include "PZdabWriter.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "struct.h"
+#include "ckptio.h"
+#include "snwin.h"
+#include "snbuf.h"
+#include "snwrite.h"
+#include "curl.h"
+
+static const uint64_t BINTICKS = 500000; // Bin width (10 ms in 50 MHz ticks)
+static const uint64_t BINSPERSEC = 50000000/BINTICKS;
+
+// State of each extra window
+struct window
+{
+uint64_t bins;     // Length in bins
+int size;          // Count to exceed to start a burst
+int end;           // Count below which the burst ends
+bool file;         // Whether to write a burst file
+bool burst;        // Whether a burst is ongoing
+int index;         // Number of bursts seen in this window
+int count;         // Number of events in the present burst
+uint64_t start;    // Start time of the present burst
+int b;             // Burst file stream, or -1
+};
+
+static window windows[MAXWINDOWS];
+static int nwindows = 0;
+static uint64_t* totals = NULL; // Running total at the start of each bin
+static uint64_t nbins = 0;      // Length of the ring
+static uint64_t curbin = 0;     // Bin of the latest event
+static uint64_t total = 0;      // Events counted so far
+static bool started = false;    // Whether any event has been counted
+
+// This function returns whether the windows set up are those of config
+static bool SameWindows(const configuration & config){
+  if(totals == NULL || nwindows != config.nwindows)
+    return false;
+  for(int i=0; i<nwindows; i++){
+    if(windows[i].bins != config.windowlen[i]*BINSPERSEC ||
+       windows[i].size != config.windowsize[i] ||
+       windows[i].end  != config.windowend[i] ||
+       windows[i].file != (config.windowfile[i] != 0))
+      return false;
+  }
+  return true;
+}
+
+// This function sets up the sliding counters, unless the same windows are
+// set up already, as when carried over from the last subfile
+void InitializeWindows(const configuration & config){
+  if(SameWindows(config))
+    return;
+  nwindows = config.nwindows;
+  nbins = 1;
+  for(int i=0; i<nwindows; i++){
+    windows[i].bins  = config.windowlen[i]*BINSPERSEC;
+    windows[i].size  = config.windowsize[i];
+    windows[i].end   = config.windowend[i];
+    windows[i].file  = config.windowfile[i];
+    windows[i].burst = false;
+    windows[i].index = 0;
+    windows[i].count = 0;
+    windows[i].start = 0;
+    windows[i].b     = -1;
+    if(windows[i].bins + 1 > nbins)
+      nbins = windows[i].bins + 1;
+  }
+  free(totals);
+  totals = (uint64_t*) calloc(nbins, sizeof(uint64_t));
+  if(totals == NULL){
+    printf("Error: Burst windows could not be initialized.\n");
+    alarm(40, "Stonehenge: Burst windows could not be initialized.", 12);
+    exit(1);
+  }
+  total = 0;
+  curbin = 0;
+  started = false;
+}
+
+// This function moves the counters forward to the bin of time longtime.
+// Bins skipped over are empty.  Time running backward is counted in the
+// latest bin.
+static void AdvanceBins(const uint64_t longtime){
+  const uint64_t bin = longtime/BINTICKS;
+  if(!started){
+    curbin = bin;
+    started = true;
+    return;
+  }
+  if(bin <= curbin)
+    return;
+  const uint64_t first = (bin - curbin > nbins) ? bin - nbins + 1 : curbin + 1;
+  for(uint64_t i=first; i<=bin; i++)
+    totals[i % nbins] = total;
+  curbin = bin;
+}
+
+// This function returns the number of events in window w
+static int WindowCount(const window & w){
+  if(curbin + 1 < w.bins)
+    return total;
+  return total - totals[(curbin + 1 - w.bins) % nbins];
+}
+
+// This function starts a burst in window i, which holds count events
+static void StartWindow(const int i, const uint64_t longtime, const int count){
+  window & w = windows[i];
+  w.burst = true;
+  w.count = count;
+  w.start = longtime;
+  char buff[128];
+  sprintf(buff, "Burst %i in the %i s window has begun!\n", w.index,
+          (int) (w.bins/BINSPERSEC));
+  fprintf(stderr, buff);
+  alarm(20, buff, 0);
+  if(w.file){
+    char suffix[32];
+    sprintf(suffix, "w%i_%i", i+1, w.index);
+    w.b = NewBurstFile(suffix);
+    CopyBuffer(w.b, longtime > w.bins*BINTICKS ? longtime - w.bins*BINTICKS
+                                               : 0);
+  }
+}
+
+// This function ends the burst in window i
+static void EndWindow(const int i, const uint64_t longtime){
+  window & w = windows[i];
+  if(w.b >= 0){
+    CloseStream(w.b);
+    w.b = -1;
+  }
+  char buff[256];
+  sprintf(buff, "Burst %i in the %i s window has ended.  It contains %i"
+                " events and lasted %.2f seconds.\n", w.index,
+          (int) (w.bins/BINSPERSEC), w.count, (longtime - w.start)/50000000.);
+  fprintf(stderr, buff);
+  alarm(20, buff, 0);
+  w.burst = false;
+  w.index++;
+}
+
+// This function drops the counts carried over from the last subfile if
+// the first event, at time firsttime, comes before them, as Checkbuffer()
+// does for the burst buffer
+void CheckWindowsStart(const uint64_t firsttime){
+  if(!started || firsttime/BINTICKS >= curbin)
+    return;
+  for(int i=0; i<nwindows; i++){
+    if(windows[i].burst){
+      fprintf(stderr, "Burst %i in the %i s window cannot be continued in "
+              "this subfile.\n", windows[i].index,
+              (int) (windows[i].bins/BINSPERSEC));
+      alarm(30, "Stonehenge: cannot continue window burst from last "
+                "subfile.", 0);
+      windows[i].burst = false;
+      windows[i].index++;
+    }
+  }
+  for(uint64_t i=0; i<nbins; i++)
+    totals[i] = 0;
+  total = 0;
+  curbin = 0;
+  started = false;
+}
+
+// This function opens a file to continue the burst of window i carried
+// over from the last subfile
+static void ReopenWindow(const int i){
+  window & w = windows[i];
+  char buff[128];
+  sprintf(buff, "Burst %i in the %i s window continues.\n", w.index,
+          (int) (w.bins/BINSPERSEC));
+  fprintf(stderr, buff);
+  alarm(20, buff, 0);
+  char suffix[32];
+  sprintf(suffix, "w%i_%i", i+1, w.index);
+  w.b = NewBurstFile(suffix);
+}
+
+// This function counts an event in all the windows
+uint32_t CountWindows(const uint64_t longtime){
+  if(!nwindows)
+    return 0;
+  AdvanceBins(longtime);
+  total++;
+
+  uint32_t bursts = 0;
+  for(int i=0; i<nwindows; i++){
+    window & w = windows[i];
+    const int count = WindowCount(w);
+    if(!w.burst){
+      if(count > w.size)
+        StartWindow(i, longtime, count);
+    }
+    else{
+      if(w.file && w.b < 0)
+        ReopenWindow(i);
+      if(w.b >= 0)
+        CopyNewest(w.b);
+      w.count++;
+      if(count < w.end)
+        EndWindow(i, longtime);
+    }
+    if(w.burst)
+      bursts |= 1 << i;
+  }
+  return bursts;
+}
+
+// This function ends the bursts of windows whose rate has fallen by time
+// longtime
+void CheckWindows(const uint64_t longtime){
+  if(!nwindows || !started)
+    return;
+  AdvanceBins(longtime);
+  for(int i=0; i<nwindows; i++){
+    if(windows[i].burst && WindowCount(windows[i]) < windows[i].end)
+      EndWindow(i, longtime);
+  }
+}
+
+// This function returns the number of extra windows
+int NumWindows(){
+  return nwindows;
+}
+
+// This function returns the present rate in window i
+float WindowRate(const int i){
+  return WindowCount(windows[i])*(float) BINSPERSEC/windows[i].bins;
+}
+
+// This function closes the burst files of the windows at the end of a
+// subfile.  Their bursts are carried into the next subfile with the counters.
+void WindowsEndofFile(){
+  for(int i=0; i<nwindows; i++){
+    window & w = windows[i];
+    if(!w.burst)
+      continue;
+    if(w.b >= 0){
+      CloseStream(w.b);
+      w.b = -1;
+    }
+    char buff[128];
+    sprintf(buff, "Burst %i in the %i s window continues past the end of "
+            "the subfile.\n", w.index, (int) (w.bins/BINSPERSEC));
+    fprintf(stderr, buff);
+    alarm(20, buff, 0);
+  }
+}
+
+// This function returns whether any window is in a burst
+bool WindowsOngoing(){
+  for(int i=0; i<nwindows; i++)
+    if(windows[i].burst)
+      return true;
+  return false;
+}
+
+// This function writes or reads the windows in a checkpoint or the burst
+// state file
+void WindowFields(ckptfile & c){
+  Field(c, nwindows);
+  if(c.reading && (nwindows < 0 || nwindows > MAXWINDOWS))
+    c.ok = false;
+  for(int i=0; i<nwindows && c.ok; i++){
+    Field(c, windows[i].bins);
+    Field(c, windows[i].size);
+    Field(c, windows[i].end);
+    Field(c, windows[i].file);
+    Field(c, windows[i].burst);
+    Field(c, windows[i].index);
+    Field(c, windows[i].count);
+    Field(c, windows[i].start);
+    windows[i].b = -1;
+  }
+  Field(c, nbins);
+  if(c.reading && c.ok){
+    free(totals);
+    totals = NULL;
+    if(nbins){
+      totals = (uint64_t*) calloc(nbins, sizeof(uint64_t));
+      if(totals == NULL){
+        printf("Error: Burst windows could not be initialized.\n");
+        alarm(40, "Stonehenge: Burst windows could not be initialized.", 12);
+        exit(1);
+      }
+    }
+  }
+  if(c.ok)
+    Fields(c, totals, nbins);
+  Field(c, curbin);
+  Field(c, total);
+  Field(c, started);
+  if(c.reading && !c.ok)
+    nwindows = 0;
+}
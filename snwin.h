@@ -0,0 +1,53 @@
+// Burst Window Header
+//
+// K Labe, October 18 2026
+// K Labe, October 18 2026 - CountWindows() takes the event from the buffer
+// K Labe, October 18 2026 - Add NumWindows() and WindowRate()
+// K Labe, October 18 2026 - Add CheckWindows()
+// K Labe, October 18 2026 - Add WindowsOngoing() and WindowFields() for
+//                           checkpoints
+// K Labe, October 18 2026 - Carry the windows across subfiles; add
+//                           CheckWindowsStart()
+
+// This function sets up the sliding counters for the extra burst windows 
+// given in config.  It should be called once the configuration is known.
+// Windows read back with the burst state (see snbuf.h) are kept if config
+// gives the same ones.
+void InitializeWindows(const configuration & config);
+
+// This function should be called with the time of the first event of a
+// subfile.  It drops the counts carried over from the last subfile if they
+// are later.
+void CheckWindowsStart(const uint64_t firsttime);
+
+// This function counts a burst candidate event at time longtime (see comment
+// elsewhere for definition) in all the extra windows, and starts or ends 
+// bursts in any window whose thresholds are crossed.  The event is the one
+// just passed to AddEvBuf, and is queued to the burst file of each window 
+// that has one open.  It returns a bitmask of the windows which are in a burst.
+uint32_t CountWindows(const uint64_t longtime);
+
+// This function should be called at every event, with its time longtime, to
+// end the bursts of any windows whose count has fallen below the end rate 
+// without waiting for the next burst candidate.
+void CheckWindows(const uint64_t longtime);
+
+// This function closes the burst files of all windows at the end of a
+// subfile.  Bursts go on in the next subfile, once the windows are saved
+// with the burst state.
+void WindowsEndofFile();
+
+// This function returns the number of extra windows configured.
+int NumWindows();
+
+// This function returns the present rate in events per second over extra
+// window i.
+float WindowRate(const int i);
+
+// This function returns whether any window is in a burst.
+bool WindowsOngoing();
+
+// This function writes the windows and their counters to a checkpoint or
+// the burst state file, or reads them back (see ckptio.h).
+struct ckptfile;
+void WindowFields(ckptfile & c);
@@ -0,0 +1,336 @@
+// Burst Writer Code
+//
+// K Labe October 18 2026
+// K Labe October 18 2026   Append burst catalog records as files close
+// K Labe October 18 2026   Flush open files every FLUSHTIME seconds
+// K Labe October 18 2026   Write records straight from their blocks
+
+// The queue is a fixed ring of requests shared by the main thread, which
+// adds to its tail, and the writer thread, which takes from its head.  A
+// request leaves the ring only once it is done, so that the main thread can
+// wait for the ring to empty to know that all its files are complete.  The
+// main thread waits if the ring is full, or if the records queued would hold
+// more than PENDINGMAX bytes of buffer memory beyond the buffer's budget.
+// Records written are flushed to disk at least every FLUSHTIME seconds of
+// wall time, whether the writer is busy or idle, so that a burst file on disk
+// is never far behind the burst.
+
+#include "PZdabFile.h"
+#include "PZdabWriter.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <map>
+#include "struct.h"
+#include "sncat.h"
+#include "snwrite.h"
+#include "curl.h"
+
+static const int RINGSIZE = 16384;              // Requests in the ring
+static const uint64_t PENDINGMAX = 0x4000000;   // Bytes queued (64 MB)
+static const int FLUSHTIME = 1;                 // Seconds between flushes
+
+// Header placed before the data of each block
+struct blockhdr
+{
+int refs;
+int spare[3];  // Keeps the data aligned to 16 bytes
+};
+
+enum requesttype { kOpen, kWrite, kClose };
+
+// A request to the writer
+struct request
+{
+requesttype type;
+int stream;
+PZdabWriter* w;    // File to take over, for kOpen
+char* block;       // Block holding the record, for kWrite
+const char* rec;   // Record, for kWrite
+uint32_t reclen;   // Length of the record in bytes
+sncatrec* entry;   // Catalog record to complete and append, for kClose
+};
+
+// A file owned by the writer
+struct openfile
+{
+PZdabWriter* w;
+bool dirty;        // Whether records have been written since the last flush
+bool events;       // Whether an event has been written
+uint64_t first;    // Offset of the block holding the first event
+};
+
+static request ring[RINGSIZE];
+static int head = 0;            // Oldest request
+static int count = 0;           // Requests in the ring, including the current
+static uint64_t pending = 0;    // Bytes of records in the ring
+static bool stopping = false;   // Whether the writer should stop when idle
+static bool running = false;    // Whether the writer thread is started
+static int nextstream = 0;      // Number of the next stream opened
+static int errors = 0;          // Number of failed writes
+static int reported = 0;        // Number of failed writes alarmed about
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t notempty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t notfull = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+
+// This function returns the header of a block
+static blockhdr* Header(char* const block){
+  return (blockhdr*) (block - sizeof(blockhdr));
+}
+
+// This function allocates a block with one reference
+char* AllocBlock(const size_t size){
+  blockhdr* hdr = (blockhdr*) malloc(sizeof(blockhdr) + size);
+  if(hdr == NULL)
+    return NULL;
+  hdr->refs = 1;
+  return (char*) (hdr + 1);
+}
+
+// This function drops a reference to a block
+void ReleaseBlock(char* const block){
+  if(__sync_sub_and_fetch(&Header(block)->refs, 1) == 0)
+    free(Header(block));
+}
+
+// This function returns whether a block has a single reference
+bool BlockUnique(char* const block){
+  return __sync_fetch_and_add(&Header(block)->refs, 0) == 1;
+}
+
+// This function writes one record to the file w.  The record is in its
+// external format, and is written without being modified.
+static int WriteRecord(PZdabWriter* const w, const char* const rec){
+  const nZDAB* const zrec = (const nZDAB*) rec;
+  const int index = PZdabWriter::GetIndex(zrec->bank_name);
+  if(index < 0)
+    return -1;
+  return w->WriteExternal((const uint32_t*) (zrec + 1), index,
+                          zrec->data_words);
+}
+
+// This function flushes the files with records not yet flushed
+static void FlushFiles(std::map<int, openfile> & streams, bool & failed){
+  for(std::map<int, openfile>::iterator it = streams.begin();
+      it != streams.end(); ++it){
+    if(it->second.dirty && it->second.w->Flush()){
+      fprintf(stderr, "Error flushing burst file\n");
+      failed = true;
+    }
+    it->second.dirty = false;
+  }
+}
+
+// This function is the writer thread.  It carries out requests in order
+// until it is stopped.
+static void* WriterLoop(void*){
+  std::map<int, openfile> streams;
+  time_t lastflush = time(NULL);
+  bool dirty = false;  // Whether any file needs flushing
+  pthread_mutex_lock(&lock);
+  while(true){
+    while(!count && !stopping){
+      if(!dirty)
+        pthread_cond_wait(&notempty, &lock);
+      else{
+        timespec until;
+        until.tv_sec = lastflush + FLUSHTIME;
+        until.tv_nsec = 0;
+        if(pthread_cond_timedwait(&notempty, &lock, &until) && !count){
+          bool failed = false;
+          pthread_mutex_unlock(&lock);
+          FlushFiles(streams, failed);
+          pthread_mutex_lock(&lock);
+          if(failed)
+            errors++;
+          lastflush = time(NULL);
+          dirty = false;
+        }
+      }
+    }
+    if(!count)
+      break;
+    const request req = ring[head];
+    pthread_mutex_unlock(&lock);
+
+    bool failed = false;
+    if(req.type == kOpen){
+      openfile & s = streams[req.stream];
+      s.w = req.w;
+      s.dirty = false;
+      s.events = false;
+      s.first = 0;
+    }
+    else if(req.type == kWrite){
+      std::map<int, openfile>::iterator it = streams.find(req.stream);
+      if(it == streams.end())
+        failed = true;
+      else{
+        openfile & s = it->second;
+        if(!s.events && ((const nZDAB*) req.rec)->bank_name == ZDAB_RECORD){
+          s.events = true;
+          s.first = s.w->GetBytesWritten();
+        }
+        failed = WriteRecord(s.w, req.rec);
+        if(failed)
+          fprintf(stderr, "Error writing zdab to burst file\n");
+        s.dirty = dirty = true;
+      }
+      ReleaseBlock(req.block);
+    }
+    else{
+      std::map<int, openfile>::iterator it = streams.find(req.stream);
+      if(it != streams.end()){
+        openfile & s = it->second;
+        s.w->Close();
+        if(req.entry){
+          req.entry->firstoffset = s.first;
+          req.entry->nbytes = s.w->GetBytesWritten();
+          // The catalog keeps as much of the path as fits
+          const char* const path = s.w->GetFilename();
+          const size_t len = strnlen(path, sizeof(req.entry->path) - 1);
+          memcpy(req.entry->path, path, len);
+          req.entry->path[len] = '\0';
+          if(AppendCatalog(*req.entry)){
+            fprintf(stderr, "Error writing burst catalog\n");
+            failed = true;
+          }
+        }
+        delete s.w;
+        streams.erase(it);
+      }
+      free(req.entry);
+    }
+    if(dirty && time(NULL) >= lastflush + FLUSHTIME){
+      FlushFiles(streams, failed);
+      lastflush = time(NULL);
+      dirty = false;
+    }
+
+    pthread_mutex_lock(&lock);
+    if(failed)
+      errors++;
+    head = (head + 1) % RINGSIZE;
+    count--;
+    pending -= req.reclen;
+    pthread_cond_signal(&notfull);
+    if(!count)
+      pthread_cond_broadcast(&idle);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+// This function raises an alarm for writes which have failed since the
+// last call
+static void ReportErrors(){
+  pthread_mutex_lock(&lock);
+  const bool newerrors = errors > reported;
+  reported = errors;
+  pthread_mutex_unlock(&lock);
+  if(newerrors)
+    alarm(30, "Stonehenge: Error writing burst file or catalog", 0);
+}
+
+// This function adds a request to the ring, waiting for room
+static void Push(const request & req){
+  pthread_mutex_lock(&lock);
+  while(count == RINGSIZE || (count && pending + req.reclen > PENDINGMAX))
+    pthread_cond_wait(&notfull, &lock);
+  ring[(head + count) % RINGSIZE] = req;
+  count++;
+  pending += req.reclen;
+  const bool newerrors = errors > reported;
+  pthread_cond_signal(&notempty);
+  pthread_mutex_unlock(&lock);
+  if(newerrors)
+    ReportErrors();
+}
+
+// This function starts the writer thread
+void InitializeWriter(){
+  if(running)
+    return;
+  stopping = false;
+  if(pthread_create(&writer, NULL, WriterLoop, NULL)){
+    printf("Error: Burst writer could not be started.\n");
+    alarm(40, "Stonehenge: Burst writer could not be started.", 12);
+    exit(1);
+  }
+  running = true;
+}
+
+// This function hands a file to the writer as a new stream
+int OpenStream(PZdabWriter* const w){
+  request req;
+  memset(&req, 0, sizeof(req));
+  req.type = kOpen;
+  req.stream = nextstream++;
+  req.w = w;
+  Push(req);
+  return req.stream;
+}
+
+// This function queues a record which lies in a block
+void QueueEvent(const int stream, char* const block, const char* const rec,
+                const uint32_t reclen){
+  __sync_fetch_and_add(&Header(block)->refs, 1);
+  request req;
+  memset(&req, 0, sizeof(req));
+  req.type = kWrite;
+  req.stream = stream;
+  req.block = block;
+  req.rec = rec;
+  req.reclen = reclen;
+  Push(req);
+}
+
+// This function queues a copy of a record
+void QueueCopy(const int stream, const char* const rec, const uint32_t reclen){
+  char* block = AllocBlock(reclen);
+  if(block == NULL){
+    printf("Error: Burst writer could not copy a record.\n");
+    alarm(40, "Stonehenge: Burst writer could not copy a record.", 12);
+    exit(1);
+  }
+  memcpy(block, rec, reclen);
+  QueueEvent(stream, block, block, reclen);
+  ReleaseBlock(block);
+}
+
+// This function queues the closing of a stream
+void CloseStream(const int stream, sncatrec* const entry){
+  request req;
+  memset(&req, 0, sizeof(req));
+  req.type = kClose;
+  req.stream = stream;
+  req.entry = entry;
+  Push(req);
+}
+
+// This function waits for the ring to empty
+void SyncWriter(){
+  pthread_mutex_lock(&lock);
+  while(count)
+    pthread_cond_wait(&idle, &lock);
+  pthread_mutex_unlock(&lock);
+  ReportErrors();
+}
+
+// This function stops the writer thread once the ring is empty
+void StopWriter(){
+  if(!running)
+    return;
+  pthread_mutex_lock(&lock);
+  stopping = true;
+  pthread_cond_signal(&notempty);
+  pthread_mutex_unlock(&lock);
+  pthread_join(writer, NULL);
+  running = false;
+  ReportErrors();
+}
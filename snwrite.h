@@ -0,0 +1,59 @@
+// Burst Writer Header
+//
+// K Labe, October 18 2026
+// K Labe, October 18 2026 - Closing a stream can append to the burst catalog
+// K Labe, October 18 2026 - Records are written without a copy
+
+// Burst files are written on a background thread, so that the main loop is
+// not held up by burst I/O while event rates are high.  The main thread opens
+// each file and hands it to the writer as a stream, then feeds it records
+// through a queue.  The writer owns the file from then on, and closes it when
+// told to.  Records are passed as handles into reference-counted blocks of
+// memory (the segments of the burst buffer), so queuing an event copies
+// nothing.  Records are kept in their external format as read, so the writer
+// writes them from the blocks as they are, and the blocks are never modified.
+
+// This function allocates a block of size bytes with one reference, and
+// returns a pointer to its data.  It returns NULL if memory is exhausted.
+char* AllocBlock(const size_t size);
+
+// This function drops a reference to a block, freeing it with the last one.
+void ReleaseBlock(char* const block);
+
+// This function returns whether the caller holds the only reference to a
+// block, in which case it may be reused.
+bool BlockUnique(char* const block);
+
+// This function starts the writer thread.  It should be called once before
+// any burst file is opened.
+void InitializeWriter();
+
+// This function hands the open file w to the writer and returns the stream
+// number by which it is fed.
+int OpenStream(PZdabWriter* const w);
+
+// This function queues the record rec, of reclen bytes, which lies in block,
+// to be written to stream.  The writer holds a reference to the block until
+// the record is written.
+void QueueEvent(const int stream, char* const block, const char* const rec,
+                const uint32_t reclen);
+
+// This function queues a copy of the record rec, of reclen bytes, to be
+// written to stream.  It is used for records which do not lie in a block.
+void QueueCopy(const int stream, const char* const rec, const uint32_t reclen);
+
+struct sncatrec;
+
+// This function queues the closing of stream, after its queued records.
+// If entry is given (allocated with malloc), the writer fills in the file
+// path and byte offsets, appends it to the burst catalog (see sncat.h) and
+// frees it.
+void CloseStream(const int stream, sncatrec* const entry = NULL);
+
+// This function waits for the writer to finish everything queued so far,
+// and raises an alarm if any writes have failed.
+void SyncWriter();
+
+// This function finishes the queue and stops the writer thread.  It should
+// be called at the end of a subfile.
+void StopWriter();
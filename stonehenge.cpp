@@ -34,6 +34,12 @@
 #include <math.h>
 #include <limits.h>
 #include <fstream>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <signal.h>
 #include <time.h>
 #include <libpq-fe.h>
@@ -41,47 +47,86 @@
 #include "curl.h"
 #include "curl/curl.h"
 #include "snbuf.h"
+#include "snwin.h"
+#include "snwrite.h"
+#include "snhist.h"
+#include "pipeline.h"
 #include "output.h"
 #include "config.h"
-
-/* constants */
-#define BASE_BUFFSIZE       32768UL     // base size of zdab record buffer
-#define MAX_BUFFSIZE        0x400000UL  // maximum size of zdab record buffer (4 MB)
-
-// the builder won't put out events with NHIT > 10000
-// (note that these are possible due to hardware problems)
-// but XSNOED can write an event with up to 10240 channels
-#define MAX_NHIT            10240
-
-// This variable holds the configuration of the parameters that determine the
-// behavior of the filter
-static configuration config;
+#include "pmthits.h"
+#include "cuts.h"
+#include "gtidtrack.h"
+#include "l2engine.h"
+#include "checkpoint.h"
 
 // This variable holds the data on all the configurations read out of the 
 // configuration file
 static configuration allconfigs[2];
 
-// This variable holds the current Nhitcut, which can be either the Hi or 
-// Lo Nhitcut, depending on what has been going on
-static int NHITCUT;
-
 // Whether to overwrite existing output
 static bool clobber = true;
 
 // Whether to write to redis database
 static bool yesredis = false;
 
-// Whether to silence alarms
-static bool silent = false;
+// Pre-trigger window (in ms) and memory budget (in MB) of the history ring
+static int pretriggerms = 0;
+static int historymb = 64;
+
+// Threads used by the main loop, and records in each batch (see pipeline.h)
+static int nthreads = 1;
+static int batchrecords = 1;
+static int reorderevents = 0;
+static int reorderus = 100;
+
+// Configuration files evaluated alongside the main one by what-if engines,
+// which decide and count but drive neither the burst buffer nor redis, and
+// whether to write the output of each
+#define MAXWHATIF 8
+static const char* whatiffiles[MAXWHATIF];
+static configuration whatifconfigs[MAXWHATIF][2];
+static int nwhatif = 0;
+static bool whatifoutput = false;
+
+// Whether only to decide and count, writing no output, burst files or burst
+// state, and reporting the rate at which records were read
+static bool statsonly = false;
+
+// Seconds between checkpoints (0 for none), and whether to resume from the
+// last checkpoint of the subfile (see checkpoint.h)
+static int checkpointsecs = 0;
+static bool resume = false;
+
+// Directory of a run whose subfiles are all to be reprocessed (see Reprocess)
+static char* rundir = NULL;
+
+// A subfile of the run directory, with the epoch at which its output was
+// decided
+struct subfilejob
+{
+char infile[1024];
+char outbase[256];
+long run;     // Run number, or -1 if the name does not give it
+int subrun;
+int epoch;
+};
 
-// Tells us when the 50MHz clock rolls over
-static const uint64_t maxtime = (1UL << 43);
+// Directory watched for subfiles to filter as they arrive (see Watch)
+static char* watchdir = NULL;
 
-// Maximum time allowed between events without a complaint
-static const uint64_t maxjump = 10*50000000; // 50 MHz time
+// Seconds for which the last subfile of the watched directory must not
+// grow before it is taken to be complete
+static const int SETTLESECS = 5;
 
-// Maximum time drift allowed between two clocks without a complaint
-static const int maxdrift = 5000; // 50 MHz ticks (1 us)
+// Set by SIGINT or SIGTERM to stop the watch once the subfile in hand is done
+static volatile sig_atomic_t stopping = 0;
+
+static std::vector<subfilejob> jobs;
+static int nextjob = 0;       // The next subfile for a worker to take
+static int startepoch = 0;    // The epoch assumed by the workers
+
+// Whether to silence alarms
+static bool silent = false;
 
 static char* password = NULL;
 
@@ -157,6 +202,33 @@ static void printhelp()
   "\n"
   "Misc/debugging options\n"
   "  -b [string]: burst naming string\n"
+  "  -m [int]: Burst buffer memory budget in MB (default 128)\n"
+  "  -p [int]: Pre-trigger window in ms of all events written to burst files\n"
+  "            (default 0: burst files hold only burst candidates)\n"
+  "  -y [int]: History ring memory budget in MB for -p (default 64)\n"
+  "  -t [int]: Threads for the main loop: 1 (default), 2 to read on its own\n"
+  "            thread, or 3 to write the output on its own thread too\n"
+  "  -k [int]: Records decided together in a batch, up to 1024 (default 1)\n"
+  "  -j [int]: Events held to put them back in time order, up to 1024\n"
+  "            (default 0: events are taken as they come)\n"
+  "  -w [int]: Longest time in us an event is held by -j (default 100)\n"
+  "  -q [string]: Pedestal table for the charge sum cut (default none)\n"
+  "  -x [string]: Another configuration file to evaluate on the same input,\n"
+  "               reporting its records and bytes written and bursts; may\n"
+  "               be given up to 8 times\n"
+  "  -e: Write the output of each -x configuration, as [base]_whatifN\n"
+  "  -z: Only decide and count: write no output, burst files, burst state\n"
+  "      or redis statistics, and report the records read per second\n"
+  "  -d [string]: Reprocess every subfile ([name]_NNN.zdab) of this run\n"
+  "               directory instead of -i, writing [base]_NNN, with the\n"
+  "               subfiles filtered in parallel on all but one core\n"
+  "  -a [string]: Watch this directory instead of -i, filtering each\n"
+  "               subfile (SNO_RRRRRRRRRR_NNN.zdab) in turn as it arrives,\n"
+  "               to [base]_RRRRRRRRRR_NNN, in one process until stopped\n"
+  "  -C [int]: Write a checkpoint to [base].ckpt at most every this many\n"
+  "            seconds, outside bursts (default 0: none)\n"
+  "  -R: Resume from the checkpoint of the subfile, cutting back the output\n"
+  "      and overwriting burst files written after it\n"
   "  -n: Do not overwrite existing output (default is to do so)\n"
   "  -r: Write statistics to the redis database.\n"
   "  -s [int]: 1 to silence alarms; 0 to play alarms\n"
@@ -164,34 +236,13 @@ static void printhelp()
   );
 }
 
-// This function prints some information at the end of the file
-static void PrintClosing(char* outfilebase, counts count, int stats[]){
-  char messg[2048];
-  sprintf(messg, "Stonehenge: Subfile %s finished."
-                 "  %lu records,  %lu events processed.\n"
-                 "%i events pass no cut\n"
-                 "%i events pass only nhit cut\n"
-                 "%i events pass only external trigger cut\n"
-                 "%i events pass both external trigger and nhit cuts\n"
-                 "%i events pass only retrigger cut\n"
-                 "%i events pass both retrigger cut and nhit cut\n"
-                 "%i events pass both retrigger cut and nhit cut\n"
-                 "%i events pass all three cuts\n",
-         outfilebase, count.recordn, count.eventn,
-         stats[0], stats[1], stats[2],
-         stats[3], stats[4], stats[5], stats[6], stats[7]);
-
-  alarm(21, messg, 0);
-  fprintf(stderr, messg);
-}
-
 // This function interprets the command line arguments to the program
 static void parse_cmdline(int argc, char ** argv, char * & infilename,
                           char * & outfilebase)
 {
   char* configfile = NULL;
   char* burstdir = NULL;
-  const char * const opts = "hi:o:l:b:t:u:c:s:nr";
+  const char * const opts = "hi:o:l:b:t:k:j:w:q:x:u:c:s:m:p:y:d:a:C:eznrR";
 
   bool done = false;
   
@@ -209,6 +260,28 @@ static void parse_cmdline(int argc, char ** argv, char * & infilename,
       case 'c': configfile = optarg; break;
 
       case 's': silentword = getcmdline_l(ch); setsilent(silentword); break;
+      case 'm': setbudget(getcmdline_l(ch)); break;
+      case 'p': pretriggerms = getcmdline_l(ch); break;
+      case 'y': historymb = getcmdline_l(ch); break;
+      case 't': nthreads = getcmdline_l(ch); break;
+      case 'k': batchrecords = getcmdline_l(ch); break;
+      case 'j': reorderevents = getcmdline_l(ch); break;
+      case 'w': reorderus = getcmdline_l(ch); break;
+      case 'q': ReadPedestals(optarg); break;
+      case 'x':
+        if(nwhatif == MAXWHATIF){
+          fprintf(stderr, "Stonehenge: At most %d what-if configurations "
+                  "may be given.\n", MAXWHATIF);
+          exit(1);
+        }
+        whatiffiles[nwhatif++] = optarg;
+        break;
+      case 'e': whatifoutput = true; break;
+      case 'z': statsonly = true; break;
+      case 'd': rundir = optarg; break;
+      case 'a': watchdir = optarg; break;
+      case 'C': checkpointsecs = getcmdline_l(ch); break;
+      case 'R': resume = true; break;
 
       case 'n': clobber = false; break;
       case 'r': yesredis = true; password = optarg; break;
@@ -218,7 +291,7 @@ static void parse_cmdline(int argc, char ** argv, char * & infilename,
     }
   }
 
-  if(!infilename){
+  if(!infilename && !rundir && !watchdir){
     char buff[128];
     sprintf(buff, "Stonehenge: Must give an input file with -i.  Aborting.\n");
     fprintf(stderr, buff);
@@ -237,332 +310,386 @@ static void parse_cmdline(int argc, char ** argv, char * & infilename,
     alarm(40, buff, 2);
   }
 
-  if(!infilename || !outfilebase || !configfile){
+  if((!infilename && !rundir && !watchdir) || !outfilebase || !configfile){
     printhelp();
     exit(1);
   }
 
-  ReadConfig(configfile, allconfigs);
+  if((rundir || watchdir) &&
+     ((rundir && watchdir) || infilename || statsonly || nwhatif)){
+    char buff[128];
+    sprintf(buff, "Stonehenge: -d and -a cannot be combined with each other,"
+                  " -i, -z or -x.  Aborting.\n");
+    fprintf(stderr, buff);
+    alarm(40, buff, 2);
+    exit(1);
+  }
+
+  if((checkpointsecs || resume) && (rundir || watchdir || statsonly ||
+     nwhatif || nthreads > 2 || reorderevents)){
+    char buff[128];
+    sprintf(buff, "Stonehenge: -C and -R cannot be combined with -d, -a, -z,"
+                  " -x, -j or -t 3.  Aborting.\n");
+    fprintf(stderr, buff);
+    alarm(40, buff, 2);
+    exit(1);
+  }
 
+  ReadConfig(configfile, allconfigs);
+  for(int i=0; i<nwhatif; i++)
+    ReadConfig(whatiffiles[i], whatifconfigs[i]);
 }
 
-// This function checks the clocks for various anomalies and raises alarms.
-// It returns true if the event passes the tests, false otherwise
-bool IsConsistent(alltimes & newat, alltimes standard, const int dd){
-  // Check for time running backward:
-  if(newat.time50 < standard.time50){
-    // Is it reasonable that the clock rolled over?
-    if((standard.time50 + newat.time50 < maxtime + maxjump) &&
-        dd < maxdrift && (standard.time50 > maxtime - maxjump) ){
-      fprintf(stderr, "New Epoch\n");
-      alarm(20, "Stonehenge: new epoch.", 0);
-      newat.epoch++;
-    }
-    else{
-      const char msg[128] = "Stonehenge: Time running backward!\n";
-      alarm(30, msg, 0);
-      fprintf(stderr, msg);
-      return false;
-    }  
+// This function lets each what-if engine decide on the batch of n records
+// recs, and writes those it keeps to its output file, if it has one
+static void WhatIf(L2Engine* const whatif[], PZdabWriter* const whatifw[],
+                   nZDAB* const recs[], const int n){
+  bool write[MAXBATCH];
+  for(int k=0; k<nwhatif; k++){
+    whatif[k]->ProcessBatch(recs, n, write);
+    if(!whatifw[k])
+      continue;
+    for(int i=0; i<n; i++)
+      if(write[i])
+        OutZdab(recs[i], whatifw[k]);
   }
-  // Check that time has not jumped too far ahead
-  if(newat.time50 - standard.time50 > maxjump){
-    char msg[128] = "Stonehenge: Large time gap between events!\n";
-    alarm(30, msg, 0);
-    fprintf(stderr, msg);
-    return false;
-  }
-  else
-    return true;
 }
 
-// This function calculates the time of an event as measured by the
-// varlous clocks we are interested in.
-static alltimes compute_times(hitinfo hits, alltimes oldat, counts & count, 
-                              bool & passretrig, bool & retrig,
-                              l2stats & stat, PZdabWriter* & b)
-{
-  static alltimes standard; // Previous unproblematic timestamp
-  static bool problem;      // Was there a problem with previous timestamp?
-  alltimes newat = oldat;
-  // For first event
-  if(count.eventn == 1){
-    newat.time50 = hits.time50;
-    newat.time10 = hits.time10;
-    if(newat.time50 == 0) stat.orphan++;
-    newat.longtime = newat.time50;
-    standard = newat;
-    problem = false;
-    Checkbuffer(newat.time50);
+// This function prints what each configuration would have written, and the
+// bursts it would have opened
+static void PrintWhatIf(const L2Engine & engine, L2Engine* const whatif[]){
+  if(!nwhatif)
+    return;
+  fprintf(stderr, "What-if: records written, bytes written, bursts opened\n");
+  const counts & c = engine.GetCounts();
+  fprintf(stderr, "  main: %lu, %lu, %lu\n", (unsigned long) c.writtenn,
+          (unsigned long) c.writtenbytes, (unsigned long) c.burstn);
+  for(int k=0; k<nwhatif; k++){
+    const counts & w = whatif[k]->GetCounts();
+    fprintf(stderr, "  %s: %lu, %lu, %lu\n", whatiffiles[k],
+            (unsigned long) w.writtenn, (unsigned long) w.writtenbytes,
+            (unsigned long) w.burstn);
   }
-  // Otherwise
-  else{
-    // Get the current 50MHz Clock Time
-    // Implementing Part of Method Get50MHzTime() 
-    // from PZdabFile.cxx
-    newat.time50 = hits.time50;
-
-    // Get the current 10MHz Clock Time
-    // Method taken from zdab_convert.cpp
-    newat.time10 = hits.time10;
-
-    // Check for consistency between clocks
-    const int dd = ( (oldat.time10 - newat.time10)*5 > oldat.time50 - newat.time50 ? 
-                     (oldat.time10 - newat.time10)*5 - (oldat.time50 - newat.time50) :
-                     (oldat.time50 - newat.time50) - (oldat.time10 - newat.time10)*5 );
-    if (dd > maxdrift){
-      char msg[128];
-      sprintf(msg, "Stonehenge: The 50MHz clock jumped by %i ticks relative"
-                   " to the 10MHz clock!\n", dd);
-      alarm(30, msg, 0);
-      fprintf(stderr, msg);
-    }
-
-    // Check for retriggers
-    if (newat.time50 - oldat.time50 > 0 &&
-        newat.time50 - oldat.time50 <= config.retrigwindow){
-      retrig = true;
-    }
-    else{
-      retrig = false;
-      passretrig = false;
-    }
+}
 
-    // Check for pathological case
-    if (newat.time50 == 0){
-      newat.time50 = oldat.time50;
-      stat.orphan++;
-      return newat;
-    }
+// This function prints the rate at which the records of the subfile were read
+// and decided, from start to stop
+static void PrintRate(const L2Engine & engine, const timespec & start,
+                      const timespec & stop){
+  const double elapsed = (stop.tv_sec - start.tv_sec) +
+                         (stop.tv_nsec - start.tv_nsec)*1e-9;
+  const counts & c = engine.GetCounts();
+  fprintf(stderr, "Stonehenge: %lu records, %lu events in %.3f s: %.0f "
+          "records per second\n", (unsigned long) c.recordn,
+          (unsigned long) c.eventn, elapsed,
+          elapsed > 0 ? c.recordn/elapsed : 0.0);
+}
 
-    // Check for well-orderedness
-    if(IsConsistent(newat, standard, dd)){
-      newat.longtime = newat.time50 + maxtime*newat.epoch;
-      standard = newat;
-      problem = false;
-    }
-    else if(problem){
-      // RESET EVERYTHING
-      alarm(40, "Stonehenge: Events out of order - Resetting buffers.", 3);
-      ClearBuffer(b, standard.longtime);
-      NHITCUT = config.nhithi;
-      newat.epoch = 0;
-      newat.longtime = newat.time50;
-      newat.exptime = 0; 
-      standard = newat;
-      problem = false;
-    }
-    else{
-      problem = true;
-      newat = standard;
-    }
-  }
-  return newat;
+// This function orders subfiles by their run and subrun numbers
+static bool BySubrun(const subfilejob & a, const subfilejob & b){
+  return a.run < b.run || (a.run == b.run && a.subrun < b.subrun);
 }
 
-// This Function performs the actual L2 cut
-// It returns true if we write out the event and false otherwise
-// Keep event if it is over nhit threshold
-// or, if it was externally triggered
-// or, if it is a retrigger to an accepted event
-bool l2filter(const uint16_t nhit, const uint32_t word, const bool passretrig, 
-              const bool retrig, int stats[]){
-  bool pass = false;
-  int key = 0;
-  if(nhit > NHITCUT){
-    pass = true;
-    key +=1;
-  }
-  if((word & config.bitmask) != 0){
-    pass = true;
-    key +=2;
+// This function lists the subfiles of the directory dirname in list, in
+// order, each to be written to [outfilebase]_NNN, or if withrun is set and
+// the name gives the run, to [outfilebase]_RRRRRRRRRR_NNN
+static void ListSubfiles(const char* const dirname,
+                         const char* const outfilebase, const bool withrun,
+                         std::vector<subfilejob> & list){
+  DIR* const dir = opendir(dirname);
+  if(!dir){
+    char buff[256];
+    snprintf(buff, sizeof(buff), "Stonehenge could not open directory "
+             "%s.  Aborting.\n", dirname);
+    fprintf(stderr, buff);
+    alarm(40, buff, 4);
+    exit(1);
   }
-  if(passretrig && retrig && nhit > config.retrigcut){
-    pass = true;
-    key +=4;
+  while(const dirent* const ent = readdir(dir)){
+    subfilejob job;
+    snprintf(job.infile, sizeof(job.infile), "%s/%s", dirname, ent->d_name);
+    job.subrun = zdab_get_subrun(job.infile);
+    if(job.subrun < 0)
+      continue;
+    job.run = zdab_get_run(job.infile);
+    if(withrun && job.run >= 0)
+      snprintf(job.outbase, sizeof(job.outbase), "%s_%010ld_%03d",
+               outfilebase, job.run, job.subrun);
+    else
+      snprintf(job.outbase, sizeof(job.outbase), "%s_%03d", outfilebase,
+               job.subrun);
+    job.epoch = -1;
+    list.push_back(job);
   }
-  for(int i=0; i<8; i++){
-    if(key == i)
-      stats[i]++;
+  closedir(dir);
+  std::sort(list.begin(), list.end(), BySubrun);
+}
+
+// This function lists the subfiles of the run directory to be reprocessed
+static void FindSubfiles(const char* const outfilebase){
+  ListSubfiles(rundir, outfilebase, false, jobs);
+  if(jobs.empty()){
+    char buff[256];
+    snprintf(buff, sizeof(buff), "Stonehenge found no subfiles in %s.  "
+             "Aborting.\n", rundir);
+    fprintf(stderr, buff);
+    alarm(40, buff, 4);
+    exit(1);
   }
-  return pass;
 }
 
-// This function writes the configuration parameters to postgresql
-void WriteConfig(char* infilename){
-  //TODO: Parse run number and subfile number from infilename
-  char configtext[1024];
-  snprintf(configtext, 1024, "runnumber: %d\n \
-                              subfile: %d\n \
-                              nhithi: %d\n \
-                              nhitlo: %d\n \
-                              lothresh: %d\n \
-                              lowindow: %d\n \
-                              retrigcut: %d\n \
-                              retrigwindow: %d\n \
-                              bitmask: %x\n \
-                              nhitbcut: %d\n \
-                              burstwindow: %d\n \
-                              burstsize: %d\n \
-                              endrate: %d\n",
-           7777, 0, config.nhithi, config.nhitlo, config.lothresh, 
-           config.lowindow, config.retrigcut, config.retrigwindow, 
-           config.bitmask, config.nhitbcut, config.burstwindow, 
-           config.burstsize, config.endrate); 
-
-  char insertstmt[1024];
-  snprintf(insertstmt, 1024, "INSERT into l2 values(%d, %d, %d, %d, %d, \
-                              %d, %d, %d, '%x', %d, %d, %d, %d);",
-           7777, 0, config.nhithi, config.nhitlo, config.lothresh,
-           config.lowindow, config.retrigcut, config.retrigwindow,
-           config.bitmask, config.nhitbcut, config.burstwindow,
-           config.burstsize, config.endrate);
-
-  const char* conninfo = "dbname = test";
-  PGConn* conn = PQconnectdb(conninfo);
-  if( PQstatus(conn) != CONNECTION_OK){
-    alarm(30, "Could not log parameters to database!  Logging here instead.\n", 0);
-    alarm(30, configtext, 0);
-    return;
+// This function opens the input file of a subfile, aborting if it cannot
+static void OpenSubfile(const subfilejob & job, FILE* & infile,
+                        PZdabFile & zfile){
+  infile = fopen(job.infile, "rb");
+  if(!infile || zfile.Init(infile) < 0){
+    fprintf(stderr, "Did not open file %s\n", job.infile);
+    alarm(40, "Stonehenge could not open input file.  Aborting.", 4);
+    exit(1);
   }
+}
 
-  PGresult* res = PQexec(conn, insertstmt);
-  if(PQresultStatus(res) != PGRES_TUPLES_OK){
-    alarm(30, "Could not log parameters to database!  Logging here instead.\n", 0);
-    alarm(30, configtext, 0);
+// This function filters a subfile with an engine whose clocks start at the
+// given epoch, and writes its output.  It drives no burst buffer, so many
+// subfiles may be written at once.  Again tells whether the output is being
+// written a second time, in which case it replaces the first.
+static void WriteSubfile(subfilejob & job, const int epoch, const bool again){
+  FILE* infile;
+  PZdabFile zfile;
+  OpenSubfile(job, infile, zfile);
+  if(again){
+    char lock[sizeof(job.outbase) + 5];
+    snprintf(lock, sizeof(lock), "%s.lock", job.outbase);
+    unlink(lock);
   }
-  fprintf(stdout, configtext);
-  return;
+  PZdabWriter* const w = Output(job.outbase, clobber || again);
+  L2Engine engine(allconfigs);
+  engine.SetName(job.outbase);
+  engine.SetEpoch(epoch);
+  while(nZDAB* const zrec = zfile.NextRecord())
+    if(engine.ProcessRecord(zrec))
+      OutZdab(zrec, w);
+  fclose(infile);
+  Close(job.outbase, w);
+  engine.Finish();
+  engine.PrintClosing();
+  job.epoch = epoch;
 }
 
-// This function zeros out the counters
-counts CountInit(){
-  counts count;
-  count.eventn = 0;
-  count.recordn = 0;
-  return count;
+// This function is run by each worker thread: it writes the subfiles not yet
+// taken, one at a time, until none are left
+static void* Worker(void*){
+  while(true){
+    const size_t i = __atomic_fetch_add(&nextjob, 1, __ATOMIC_RELAXED);
+    if(i >= jobs.size())
+      break;
+    WriteSubfile(jobs[i], startepoch, false);
+  }
+  return NULL;
 }
 
-// This function initialzes the time object
-static alltimes InitTime(){
-  alltimes alltime;
-  alltime.walltime = 0;
-  alltime.oldwalltime = 0;
-  alltime.exptime = 0;
-  alltime.epoch = GetEpoch();
-  return alltime;
+// This function takes a subfile through the burst buffer, as a run of
+// stonehenge on it alone would, but writes no output.  The burst state it
+// leaves is picked up by the next subfile.
+static void BurstSubfile(subfilejob & job){
+  FILE* infile;
+  PZdabFile zfile;
+  OpenSubfile(job, infile, zfile);
+  L2Engine engine(allconfigs);
+  engine.SetPrimary(job.infile, job.outbase, clobber, false);
+  while(nZDAB* const zrec = zfile.NextRecord())
+    engine.ProcessRecord(zrec);
+  fclose(infile);
+  engine.Finish();
 }
 
-// This function sets the trigger threshold appropriately
-// The "Kalpana" solution
-static void setthreshold(uint16_t nhit, alltimes & alltime){
-  if(nhit > config.lothresh){
-    alltime.exptime = alltime.longtime + config.lowindow;
-    NHITCUT = config.nhitlo;
+// This function reprocesses every subfile of the run directory.  The only
+// state which passes from one subfile to the next is that of the burst
+// buffer, and the epoch it hands on, so the outputs are written by workers
+// on all but one core, each taking the next subfile not yet taken, while
+// this thread takes the subfiles through the burst buffer in order.  The
+// workers assume the epoch of the first subfile; any subfile which turns
+// out to start at another epoch is written again once they are done.  The
+// burst pass, which decides every record again but writes nothing, takes
+// about a quarter of the time of the output, and bounds the speedup.
+static void Reprocess(const char* const outfilebase){
+  FindSubfiles(outfilebase);
+  long nworkers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  if(nworkers < 1)
+    nworkers = 1;
+  if(nworkers > (long) jobs.size())
+    nworkers = jobs.size();
+  std::vector<pthread_t> workers(nworkers);
+  std::vector<int> epochs(jobs.size());
+
+  InitializeWriter();
+  InitializeHistory(historymb, pretriggerms);
+  for(size_t i=0; i<jobs.size(); i++){
+    setsubfile(jobs[i].subrun);
+    InitializeBuf(jobs[i].outbase, clobber);
+    ClearHistory();
+    epochs[i] = GetEpoch();
+    if(i == 0){
+      startepoch = epochs[0];
+      for(long k=0; k<nworkers; k++){
+        if(pthread_create(&workers[k], NULL, Worker, NULL)){
+          fprintf(stderr, "Stonehenge: Could not start worker thread.\n");
+          alarm(40, "Stonehenge could not start a worker thread.", 12);
+          exit(1);
+        }
+      }
+    }
+    BurstSubfile(jobs[i]);
   }
-  if(alltime.longtime > alltime.exptime){
-    NHITCUT = config.nhithi;
+  for(long k=0; k<nworkers; k++)
+    pthread_join(workers[k], NULL);
+
+  for(size_t i=0; i<jobs.size(); i++){
+    if(jobs[i].epoch == epochs[i])
+      continue;
+    fprintf(stderr, "Stonehenge: %s starts at epoch %d, not %d; writing it "
+            "again\n", jobs[i].infile, epochs[i], jobs[i].epoch);
+    WriteSubfile(jobs[i], epochs[i], true);
   }
+  StopWriter();
+  fprintf(stderr, "Stonehenge: %lu subfiles reprocessed on %ld workers\n",
+          (unsigned long) jobs.size(), nworkers);
 }
 
-// This function checks unix time to see whether to update the times
-static void updatetime(alltimes & alltime){
-  if(alltime.walltime!=0)
-    alltime.oldwalltime=alltime.walltime;
-  alltime.walltime = (int) time(NULL);
+// This function asks the watch to stop once the subfile in hand is done
+static void StopWatch(int){
+  stopping = 1;
 }
 
-// This function just puts a bunch of zeros in a hitinfo struct
-// to initialize it
-static hitinfo InitHit(){
-  hitinfo hit;
-  hit.time50 = 0;
-  hit.time10 = 0;
-  hit.triggertype = 0;
-  hit.nhit = 0;
-  hit.reclen = 0;
-  hit.gtid = 0;
-  hit.run = 0;
-  return hit;
-}
-
-// This function reads out the information about each event that we need
-// for making decisions/processing.  It then restores the hit data to its
-// external format.
-// This is based on PZdabFile::GetPmtRecord but it does not leave things
-// in a byte-swapped state.
-// If the function is passed a non ZDAB_RECORD it returns 1.
-static int ReadHits(nZDAB* zrec, hitinfo& hit){
-  PmtEventRecord* pmtEventPtr;
-  // Check that the record is a ZDAB bank
-  if( zrec->bank_name != ZDAB_RECORD ){
-    return 1;
+// This function finds the next subfile of the watched directory after
+// subfile last, and returns whether it is complete: either a later subfile
+// has appeared, or it has not grown for SETTLESECS seconds.  A subfile taken
+// for not growing may only have been paused by its writer, so it is watched
+// until a later one appears, and an alarm raised if it grows after all.
+static bool NextWatched(const char* const outfilebase,
+                        const subfilejob & last, subfilejob & job){
+  static subfilejob candidate = { "", "", -1, -1, -1 };
+  static off_t candidatesize = -1;
+  static time_t candidatesince = 0;
+  static subfilejob settled = { "", "", -1, -1, -1 };
+  static off_t settledsize = -1;
+
+  std::vector<subfilejob> list;
+  ListSubfiles(watchdir, outfilebase, true, list);
+  size_t i = 0;
+  while(i < list.size() && !BySubrun(last, list[i]))
+    i++;
+
+  struct stat st;
+  if(settled.subrun >= 0 && !stat(settled.infile, &st) &&
+     st.st_size != settledsize){
+    char buff[1200];
+    snprintf(buff, sizeof(buff), "Stonehenge: %s grew after it was taken to "
+             "be complete.  Its output is missing the rest.\n",
+             settled.infile);
+    fprintf(stderr, buff);
+    alarm(30, buff, 0);
+    settled.subrun = -1;
   }
+  if(i < list.size())
+    settled.subrun = -1;
 
-  pmtEventPtr = (PmtEventRecord*) (zrec + 1);
+  if(i == list.size())
+    return false;
+  job = list[i];
+  if(i + 1 < list.size())
+    return true;
 
-  // Read nhit and check that it is sensible
-  // If not, throw alarm and return empty object
-  SWAP_PMT_RECORD( pmtEventPtr );
-  hit.nhit = pmtEventPtr->NPmtHit;
-  if(hit.nhit > MAX_NHIT){
-    fprintf(stderr, "Read error: Bad ZDAB -- %d pmt hit!\x07\n", hit.nhit);
-    alarm(30, "Too many hits found!\n", 0);
-    return 1;
+  if(stat(job.infile, &st))
+    return false;
+  const time_t now = time(NULL);
+  if(job.run != candidate.run || job.subrun != candidate.subrun ||
+     st.st_size != candidatesize){
+    candidate = job;
+    candidatesize = st.st_size;
+    candidatesince = now;
+    return false;
   }
+  if(now - candidatesince < SETTLESECS)
+    return false;
+  settled = job;
+  settledsize = st.st_size;
+  return true;
+}
 
-  // Read the gtid and run number
-  hit.gtid = pmtEventPtr->TriggerCardData.BcGT;
-  hit.run  = pmtEventPtr->RunNumber;
-
-  // Read the 50 MHz and 10 MHz clock times
-  // This method copied from PZdabFile
-  hit.time50 = (uint64_t(pmtEventPtr->TriggerCardData.Bc50_2) << 11)
-                        + pmtEventPtr->TriggerCardData.Bc50_1;
-  hit.time10 = (uint64_t(pmtEventPtr->TriggerCardData.Bc10_2) << 32)
-                        + pmtEventPtr->TriggerCardData.Bc10_1;
-
-  // Next retrieve the trigger word
-  // This method copied from zdab_convert
-  uint32_t mtcwords[6];
-  memcpy(mtcwords, &(pmtEventPtr->TriggerCardData), 6*sizeof(uint32_t));
-  hit.triggertype = ((mtcwords[3] & 0xff000000) >> 24) |
-                    ((mtcwords[4] & 0x3ffff) << 8);
-
-  // Then report the length of the record in words
-  // 9 words for nZDAB, 11 words for PmtEventRecord, 3 words per nhit
-  // plus the length of any subrecords
-  // This method copied from PZdabFile
-  uint32_t event_size = 20 + 3*hit.nhit;
-  uint32_t* sub_header = &pmtEventPtr->CalPckType;
-  while( *sub_header & SUB_NOT_LAST ){
-    uint32_t jump = (*sub_header & SUB_LENGTH_MASK);
-    if( jump > MAX_BUFFSIZE/4 ){
-      fprintf(stderr, "Error: wanted to jump past the end of the buffer\n");
-      return(0);
+// This function filters the subfiles of the watched directory in order, as
+// each is completed, until stopped by SIGINT or SIGTERM.  Everything set up
+// for the first subfile of a run is kept for the rest of it: the
+// connections, the buffers, and all the state of the filter and the burst
+// buffer, so nothing is read from or saved to disk between subfiles.  A new
+// run starts with a new engine, and the burst state saved and read again,
+// as it would in a new process.  The burst state is saved when the watch
+// stops, for the next process to pick up.
+static void Watch(const char* const outfilebase){
+  signal(SIGINT, StopWatch);
+  signal(SIGTERM, StopWatch);
+  InitializeWriter();
+  InitializeHistory(historymb, pretriggerms);
+
+  L2Engine* engine = NULL;
+  subfilejob job;  // The engine and burst buffer keep pointers to its names
+  job.run = -1;
+  job.subrun = -1;
+  while(!stopping){
+    subfilejob next;
+    if(!NextWatched(outfilebase, job, next)){
+      sleep(1);
+      continue;
     }
-    SWAP_INT32(sub_header, 1);
-    sub_header += jump;
-    SWAP_INT32(sub_header, 1);
-    uint32_t datawords = (*sub_header & SUB_LENGTH_MASK);
-    event_size += datawords;
-    SWAP_INT32(sub_header, datawords);
+    if(engine && next.run != job.run){
+      fprintf(stderr, "Stonehenge: Run %ld begins in %s\n", next.run,
+              watchdir);
+      engine->Finish();
+      delete engine;
+      engine = NULL;
+    }
+    job = next;
+    setsubfile(job.subrun);
+    if(!engine){
+      engine = new L2Engine(allconfigs);
+      InitializeBuf(job.outbase, clobber);
+      ClearHistory();
+      engine->SetPrimary(job.infile, job.outbase, clobber, yesredis);
+    }
+    else
+      engine->NextSubfile(job.infile, job.outbase);
+
+    FILE* infile;
+    PZdabFile zfile;
+    OpenSubfile(job, infile, zfile);
+    PZdabWriter* const w = Output(job.outbase, clobber);
+    StartPipeline(&zfile, w, nthreads, batchrecords, reorderevents,
+                  reorderus);
+    nZDAB* recs[MAXBATCH];
+    bool write[MAXBATCH];
+    while(const int n = NextBatch(recs)){
+      engine->ProcessBatch(recs, n, write);
+      PassBatch(write);
+    }
+    StopPipeline();
+    fclose(infile);
+    Close(job.outbase, w);
+    engine->EndSubfile();
+    engine->PrintClosing();
+    PrintPipeline();
+    Flusherrors();
   }
-  hit.reclen = event_size;
-
-  // Finally, restore the record to its external state
-  SWAP_PMT_RECORD( pmtEventPtr );
-  SWAP_INT32( pmtEventPtr+1, 3*hit.nhit);
-  return 0;
+  if(engine){
+    engine->Finish();
+    delete engine;
+  }
+  StopWriter();
+  fprintf(stderr, "Stonehenge: Stopped watching %s\n", watchdir);
 }
 
 // MAIN FUCTION 
 int main(int argc, char *argv[])
 {
-  // This states whether we have received the Run Header, and therefore set
-  // the cut configuration
-  bool configknown = false;
-
   // Connect to minard for monitoring
   Opencurl(password);
 
@@ -571,6 +698,24 @@ int main(int argc, char *argv[])
 
   parse_cmdline(argc, argv, infilename, outfilebase);
 
+  if(watchdir){
+    if(yesredis)
+      Openredis();
+    Watch(outfilebase);
+    Flusherrors();
+    if(yesredis)
+      Closeredis();
+    Closecurl();
+    return 0;
+  }
+
+  if(rundir){
+    Reprocess(outfilebase);
+    Flusherrors();
+    Closecurl();
+    return 0;
+  }
+
   FILE* infile = fopen(infilename, "rb");
 
   PZdabFile* zfile = new PZdabFile();
@@ -580,122 +725,112 @@ int main(int argc, char *argv[])
     exit(1);
   }
 
+  // Only counting, the engine drives nothing and nothing is written
+  if(statsonly)
+    yesredis = false;
+
   // Prepare to record statistics in redis database
-  l2stats stat;
   if(yesredis) 
-    Openredis(stat);
+    Openredis();
 
+  // Burst files written after the checkpoint are written again on resuming
+  const bool burstclobber = clobber || resume;
 
-  // Setup initial output file
-  PZdabWriter* w1  = Output(outfilebase, clobber);
-  PZdabWriter* b = NULL; // Burst event file
-
-  // Set up the Burst Buffer
-  InitializeBuf();
-
-  // Initialize the various clocks and the hitinfo object
-  alltimes alltime = InitTime();
-  hitinfo hits = InitHit();
-
-  // Flags for the retriggering logic:
-  // passretrig true means that if the next event is a retrigger, we should 
-  // apply the special retrigger threshold.
-  // retrig true means that this event is a retrigger (defined in the sense
-  // 0 < dt < 460 ns ).
-  bool passretrig = false;
-  bool retrig = false;
+  // Set up the Burst Buffer, and start the thread that writes burst files
+  if(!statsonly){
+    InitializeWriter();
+    setsubfile(zdab_get_subrun(infilename));
+    InitializeBuf(outfilebase, burstclobber);
+    InitializeHistory(historymb, pretriggerms);
+  }
 
-  // Loop over ZDAB Records
-  counts count = CountInit();
-  int stats[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-  while(nZDAB * const zrec = zfile->NextRecord()){
-    // Fill Header buffer if necessary
-    // Check for runtype, configure and record parameters if necessary
-    uint32_t runtype = FillHeaderBuffer(zrec);
-    if(runtype && !configknown){
-      SetConfig(runtype, allconfigs, config);
-      WriteConfig(infilename);
-      configknown = true;
-    }
-    if(runtype && configknown){
-      alarm(30, "Stonehenge: RHDR Record in the middle of a run!\n", 0);
+  // The engine which makes every decision, and drives the burst buffer
+  L2Engine engine(allconfigs);
+  if(!statsonly)
+    engine.SetPrimary(infilename, outfilebase, burstclobber, yesredis);
+  else
+    engine.SetName(outfilebase);
+
+  // Carry on from the last checkpoint if asked, passing over the records
+  // already decided but keeping their headers for burst files, or set up
+  // the initial output file
+  PZdabWriter* w1 = NULL;
+  uint64_t skip = 0;
+  if(resume)
+    w1 = ReadCheckpoint(infilename, outfilebase, engine, skip);
+  for(uint64_t i=0; i<skip; i++){
+    nZDAB* const zrec = zfile->NextRecord();
+    if(!zrec)
+      break;
+    FillHeaderBuffer(zrec);
+  }
+  if(!w1 && !statsonly)
+    w1 = Output(outfilebase, clobber);
+
+  // The what-if engines, each with its own output file if asked
+  L2Engine* whatif[MAXWHATIF];
+  PZdabWriter* whatifw[MAXWHATIF];
+  char whatifbase[MAXWHATIF][256];
+  for(int k=0; k<nwhatif; k++){
+    whatif[k] = new L2Engine(whatifconfigs[k]);
+    whatifw[k] = NULL;
+    if(whatifoutput){
+      snprintf(whatifbase[k], sizeof(whatifbase[k]), "%s_whatif%d",
+               outfilebase, k+1);
+      whatifw[k] = Output(whatifbase[k], clobber);
     }
+  }
 
-    // If the record has an associated time, compute all the time
-    // variables.  Non-hit records don't have times.
-    if(! ReadHits(zrec, hits)){
-      count.eventn++;
-      alltime = compute_times(hits, alltime, count, passretrig, retrig, stat, b);
-
-      // Write statistics to Redis if necessary
-      updatetime(alltime);
-      if (alltime.walltime!=alltime.oldwalltime){
-        if(yesredis){
-          gtid(stat, hits);
-          Writetoredis(stat, alltime.oldwalltime);
-        }
-        Flusherrors();
-      }
-
-      // If we don't have the run type yet, use defaults and throw error
-      if(!configknown){
-        SetConfig(0, allconfigs, config);
-        WriteConfig(infilename);
-        alarm(30, "Stonehenge: No RHDR Record found!  Using default cuts!\n", 0);
-        configknown = true;
-      }
-
-      // Should we adjust the trigger threshold?
-      setthreshold(hits.nhit, alltime);
-
-      // Burst Detection Here
-      // If the current event is over our burst nhit threshold (nhitbcut):
-      //   * First update the buffer by dropping events older than burstwindow
-      //   * Then add the new event to the buffer
-      //   * If we were not in a burst, check whether one has started
-      //   * If we were in a burst: write event to file, and check if the burst has ended
-
-      uint32_t word = hits.triggertype; 
-      uint32_t reclen = hits.reclen;
-
-      if(hits.nhit > config.nhitbcut && ((word & config.bitmask) == 0) ){
-        UpdateBuf(alltime.longtime, config.burstwindow);
-        AddEvBuf(zrec, alltime.longtime, reclen*sizeof(uint32_t), b);
-
-        // Write to burst file if necessary
-        // A comment here about the following bit of opaque code:
-        // Burstfile returns whether a burst is ongoing, but we want burstbool
-        // to remain true after the burst ends, until it is reset.  We therefore
-        // logical-OR the return value of Burstfile with the existing value of 
-        // stat.burstbool.
-        stat.burstbool = (stat.burstbool | Burstfile(b, config, alltime,
-                          outfilebase, clobber) );
-
-      } // End Burst Loop
-      // L2 Filter
-      if(l2filter(hits.nhit, word, passretrig, retrig, stats)){
-        OutZdab(zrec, w1, zfile);
-        passretrig = true;
-        stat.l2++;
-      }
-    } // End Loop for Event Records
-
-    // Write out all non-event records:
-    else{
-      OutZdab(zrec, w1, zfile);
-      stat.l2++;
+  // Loop over ZDAB Records
+  // Each record read is passed on to the output file stage, to be written if
+  // it passes the L2 filter
+  StartPipeline(zfile, w1, nthreads, batchrecords, reorderevents,
+                reorderus);
+  nZDAB* recs[MAXBATCH];
+  bool write[MAXBATCH];
+  timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  time_t nextcheckpoint = time(NULL) + checkpointsecs;
+  // A first checkpoint before any record is decided, when no burst file can
+  // be open, so that resuming never writes the same burst twice
+  if(checkpointsecs && !skip)
+    WriteCheckpoint(outfilebase, w1, engine);
+  while(const int n = NextBatch(recs)){
+    engine.ProcessBatch(recs, n, write);
+    WhatIf(whatif, whatifw, recs, n);
+    PassBatch(write);
+    if(checkpointsecs && time(NULL) >= nextcheckpoint &&
+       engine.CanCheckpoint()){
+      WriteCheckpoint(outfilebase, w1, engine);
+      nextcheckpoint = time(NULL) + checkpointsecs;
     }
-    count.recordn++;
-    stat.l1++;
   } // End of the Event Loop for this subrun file
+  StopPipeline();
+  timespec stop;
+  clock_gettime(CLOCK_MONOTONIC, &stop);
   if(w1) Close(outfilebase, w1);
-  BurstEndofFile(b, alltime.longtime);
+  engine.Finish();
+  if(checkpointsecs || resume)
+    RemoveCheckpoint(outfilebase);
+  for(int k=0; k<nwhatif; k++){
+    if(whatifw[k])
+      Close(whatifbase[k], whatifw[k]);
+    whatif[k]->Finish();
+  }
+  if(!statsonly)
+    StopWriter();
   delete zfile;
 
   Flusherrors();
   if(yesredis)
     Closeredis();
-  PrintClosing(outfilebase, count, stats);
+  engine.PrintClosing();
+  PrintWhatIf(engine, whatif);
+  if(statsonly)
+    PrintRate(engine, start, stop);
+  for(int k=0; k<nwhatif; k++)
+    delete whatif[k];
+  PrintPipeline();
   Closecurl();
   return 0;
 }
@@ -2,9 +2,23 @@
 //
 // K Labe, September 24 2014
 // K Labe, February 4 2015 - Add hitinfo struct
+// K Labe, October 18 2026  - Add extra burst windows to configuration
+// K Labe, October 18 2026  - Add nhit dependent prescale tiers
+// K Labe, October 18 2026  - Add the TAC window of the nhit cut
+// K Labe, October 18 2026  - Add the charge sum cut
+// K Labe, October 18 2026  - Add the flasher tagger
+// K Labe, October 18 2026  - Add the output rate control
+// K Labe, October 18 2026  - Add the GTID counts and dropping of duplicates
+// K Labe, October 18 2026  - Count the records written and bursts opened
 
 #include <stdint.h>
 
+// Maximum number of burst windows in addition to the main burstwindow
+#define MAXWINDOWS 8
+
+// Maximum number of nhit dependent prescale tiers
+#define MAXPRESCALES 4
+
 // This structure holds the variables set by the configuration file and recorded
 // to couchdb
 struct configuration
@@ -16,11 +30,36 @@ int lowindow;     // The time for lowering the cut, in 50 MHz ticks
 int retrigcut;    // The nhit cut for retriggered events
 int retrigwindow; // The max time between retriggered events, in 50 MHz ticks
 int prescale;     // The prescale fraction (eg 100 = "save 1 in 100 events")
+                  // for events in no tier, or 0 for no prescale
 uint32_t bitmask; // The external trigger bitmask
 int nhitbcut;     // The nhit cut for inclusion in bursts
 int burstwindow;  // The integration time for spotting bursts (in secs)
 int burstsize;    // The count to exceed to be a burst
 int endrate;      // Rate below which burst ends
+int nwindows;                // Number of extra burst windows
+int windowlen[MAXWINDOWS];   // Integration time of each window (in secs)
+int windowsize[MAXWINDOWS];  // The count to exceed to be a burst in the window
+int windowend[MAXWINDOWS];   // Count below which the window's burst ends
+int windowfile[MAXWINDOWS];  // 1 to write a burst file for the window, 0 to
+                             // only flag bursts
+int nprescales;                   // Number of nhit dependent prescale tiers
+int prescalenhit[MAXPRESCALES];   // Tier applies below this nhit (increasing)
+int prescaletier[MAXPRESCALES];   // The prescale fraction of the tier
+int tacwindow;    // Width in TAC counts of the window of hits counted by the
+                  // nhit cut, or 0 to count every hit
+int chargetype;   // The charge summed by the charge cut (see pmthits.h), or
+                  // 0 for no such cut
+int chargecut;    // The summed charge to exceed, less pedestals (ADC counts)
+int flashernhit;  // Events of at least this nhit are tested for flashers, or
+                  // 0 for no flasher tagging
+int flashercrate; // Percentage of hits in one crate over which an event is a
+                  // flasher
+int flashercard;  // Percentage of hits in one card over which an event is a
+                  // flasher
+int ratetarget;   // Output rate to stay under, in bytes per second of
+                  // detector time, or 0 for no rate control
+int maxoffset;    // Largest offset the rate control may add to the nhit cut
+int dropduplicates; // 1 to drop exact duplicates of events, by GTID, or 0
 };
 
 // Structure to hold all the relevant times
@@ -38,9 +77,18 @@ uint64_t exptime;
 // Structure to hold all the things we count
 struct counts
 {
-uint64_t prescalen;
+uint64_t prescalen[MAXPRESCALES+1]; // Events seen by each prescale tier, the
+                                    // last for events in no tier
 uint64_t eventn;
 uint64_t recordn;
+uint64_t flashern; // Events tagged as flashers
+uint64_t gtidlost;    // GTIDs which never arrived
+uint64_t gtidlate;    // Events which arrived after a later GTID
+uint64_t gtiddup;     // Events whose GTID was seen already
+uint64_t gtiddropped; // Exact duplicates dropped
+uint64_t writtenn;    // Records to be written out
+uint64_t writtenbytes; // Bytes of the records to be written out
+uint64_t burstn;      // Bursts opened in the main burst window
 };
 
 // Structure to hold all the information we want to read out of the hits